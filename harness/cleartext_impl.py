@@ -12,7 +12,8 @@ benchmark that operates on cleartext data.
 # See the LICENSE.md file for details.
 import argparse
 import numpy as np
-from params import InstanceParams, TOY, LARGE
+from params import InstanceParams, TOY, LARGE, TOP_K_LADDER, TOP_K_PER_BAND, \
+    MAX_N_MATCH, query_file
 
 # The payloads are vectors of 7 int16 numbers in the range [0,4095)
 PAYLOAD_DIM = 7
@@ -24,6 +25,23 @@ def main():
     * Compute the vector of similarities sim = M*v
     * Extract that payload vectors for rows i for which sim[i]>0.8
     * Sort the extracted vectors and write to disk
+    If the query file holds several vectors, each one gets its own expected
+    file, expected_NNNN.bin.
+    With --reduce_dim D, the similarities are those of the records and
+    queries projected to dimension D (using the projection.bin of
+    client_preprocess_dataset), as the server computes them, so the expected
+    files are those of the projected search. The recall and precision of
+    the projected search relative to the exact one are reported separately.
+    With --top_k K, extract the payloads that the top-k mode of the server
+    returns instead, which are not always the K best matches: it keeps only
+    the first TOP_K_PER_BAND matches of each band of TOP_K_LADDER in every
+    column of the answer (see top_k_matches).
+    With --thresholds T1,T2,..., each query gets an expected file for every
+    threshold, the one for query q and threshold t has number
+    q*#thresholds+t.
+    With --ivf, only the records in the batches that the server scans for
+    these queries can match (see scanned_batches), and the number of
+    matches that the probing misses is reported.
     """
     # Parse arguments using argparse
     parser = argparse.ArgumentParser(description='Cleartext implementation of fetch-by-similarity workload.')
@@ -31,9 +49,25 @@ def main():
                         help='Instance size (0-toy/1-small/2-medium/3-large)')
     parser.add_argument('--count_only', action='store_true',
                         help='Only count # of matches, do not return payloads')
+    parser.add_argument('--reduce_dim', type=int, default=0,
+                        help='Search with the records and queries projected '
+                             'to this dimension, and report the recall/'
+                             'precision relative to the exact search')
+    parser.add_argument('--top_k', type=int, default=0,
+                        help='Extract the payloads of up to K matches, as '
+                             'the top-k mode of the server selects them')
+    parser.add_argument('--thresholds', type=str, default="0.8",
+                        help='Comma-separated similarity thresholds, with '
+                             'one expected result for each (default: 0.8)')
+    parser.add_argument('--ivf', action='store_true',
+                        help='The dataset was encrypted in the inverted-file '
+                             'order, and the queries have probe lists')
 
     args = parser.parse_args()
     size = args.size
+    if args.count_only and args.top_k > 0:
+        parser.error("--top_k returns payloads, not a count")
+    thresholds = [float(t) for t in args.thresholds.split(',')]
 
     # Use params.py to get instance parameters
     params = InstanceParams(size)
@@ -43,29 +77,178 @@ def main():
     dataset_dir = params.datadir()
     db = np.fromfile(dataset_dir / "db.bin", dtype=np.float32).reshape(-1, dim)
 
-    # read the query from file, a single record of dimension dim
-    v = np.fromfile(dataset_dir / "query.bin", dtype=np.float32)
+    # read the queries from file, records of dimension dim
+    qrys = np.fromfile(dataset_dir / "query.bin", dtype=np.float32).reshape(-1, dim)
 
-    # Compute the similarities between the query and all the vectors in db
-    sim = db @ v # matrix multiplication
-    matches = sim > 0.8
-
-    if args.count_only:
-        # Write to file the number of matches, as an int16
-        n_matches: np.int_ = matches.sum()
-        n_matches.tofile(dataset_dir/"expected.bin")
-        # NOTE: to_file write complete machine words, even if the value is short
-
-    else:
+    payloads = None
+    if not args.count_only:
         # Read the payloads, vectors of dimension PAYLOAD_DIM=7
         payload_file = dataset_dir / "payloads.bin"
         payloads = np.fromfile(payload_file, dtype=np.int16).reshape(-1, PAYLOAD_DIM)
-        # Extract the payload vectors for the matches
-        extracted_payloads = payloads[matches]
 
-        # Sort the payload vectors lexicographically and write to disk
-        sorted_ps = extracted_payloads[np.lexsort(extracted_payloads.T[::-1])]
-        sorted_ps.tofile(dataset_dir/"expected.bin")
+    reduced_sims = None
+    if args.reduce_dim > 0:
+        reduced_sims = projected_similarities(
+            db, qrys, dataset_dir / "projection.bin", args.reduce_dim)
+
+    # The position of every record in the encrypted dataset, and the
+    # batches that the server scans
+    n_slots = params.get_n_slots()
+    position = np.arange(len(db))
+    if args.ivf:
+        order = np.fromfile(dataset_dir / "ivf_order.bin", dtype=np.uint32)
+        position[order] = np.arange(len(db))
+    batches = np.arange((len(db) + n_slots - 1) // n_slots)
+    scanned = None
+    if args.ivf:
+        batches = scanned_batches(params, len(qrys), len(batches))
+        scanned = np.isin(position // n_slots, batches)
+    if args.top_k > 0:
+        column, place = answer_columns(params, position, batches)
+
+    # The recall is reported at the lowest threshold that the answer uses
+    lowest = TOP_K_LADDER[-1] if args.top_k > 0 else min(thresholds)
+    n_answers = len(qrys) * len(thresholds)
+    for q, v in enumerate(qrys):
+        # Compute the similarities between the query and all the vectors in db
+        sim = db @ v # matrix multiplication
+        if reduced_sims is not None:
+            report_recall(q, sim > lowest, reduced_sims[:, q] > lowest)
+            sim = reduced_sims[:, q]
+        if scanned is not None:
+            # The records in batches that are not scanned never match
+            report_probed(q, sim > lowest, scanned)
+            sim = np.where(scanned, sim, -np.inf)
+
+        for t, threshold in enumerate(thresholds):
+            expected_file = query_file(dataset_dir, "expected",
+                                       q * len(thresholds) + t, n_answers)
+            matches = sim > threshold
+            if args.top_k > 0:
+                matches = top_k_matches(q, sim, payloads, args.top_k,
+                                        column, place)
+
+            if args.count_only:
+                # Write to file the number of matches, as an int16
+                n_matches: np.int_ = matches.sum()
+                n_matches.tofile(expected_file)
+                # NOTE: to_file write complete machine words, even if the value is short
+
+            else:
+                # Extract the payload vectors for the matches
+                extracted_payloads = payloads[matches]
+
+                # Sort the payload vectors lexicographically and write to disk
+                sorted_ps = extracted_payloads[np.lexsort(extracted_payloads.T[::-1])]
+                sorted_ps.tofile(expected_file)
+
+def answer_columns(params, position, batches):
+    """
+    Where the matches of every record go in the answer: its column, and its
+    place among the records of that column (or -1 if its batch is not
+    scanned). The server views the matches of the k'th scanned batch as a
+    matrix with n_cols columns, slot i in row i//n_cols and column
+    i%n_cols, and interleaves these matrices, so row r of batch k is row
+    r*#batches+k of the whole (see running_sums.h).
+    """
+    n_slots = params.get_n_slots()
+    n_cols = params.get_n_cols()
+    slot = position % n_slots
+    batch = position // n_slots
+    place = (slot // n_cols) * len(batches) + np.searchsorted(batches, batch)
+    return slot % n_cols, np.where(np.isin(batch, batches), place, -1)
+
+def top_k_matches(q, sim, payloads, k, column, place):
+    """
+    The matches that the top-k mode returns, as a boolean vector. For every
+    band [TOP_K_LADDER[b], TOP_K_LADDER[b-1]), the server keeps the first
+    TOP_K_PER_BAND matches of each column of the answer (by their place in
+    the column, see answer_columns), and client_postprocess takes the kept
+    matches of the highest bands until it has k of them, those with the
+    smallest payloads from the last band that it needs. Records at or below
+    the last threshold are never returned. A band with more than
+    MAX_N_MATCH matches in a column garbles that column of the answer (even
+    if that band is not needed), this is reported since the answer will
+    not match the expected one.
+    """
+    selected = np.zeros(len(sim), dtype=bool)
+    upper = np.inf
+    for b, threshold in enumerate(TOP_K_LADDER):
+        band = np.flatnonzero((sim > threshold) & (sim <= upper) &
+                              (place >= 0))
+        upper = threshold
+
+        # Sort the band by column and place, and keep the first matches of
+        # every column
+        band = band[np.lexsort((place[band], column[band]))]
+        first = np.searchsorted(column[band], column[band])  # of its column
+        rank = np.arange(len(band)) - first
+        crowded = np.unique(column[band][rank >= MAX_N_MATCH])
+        if len(crowded) > 0:
+            print(f"         [harness] query {q}: band {b} has more than "
+                  f"{MAX_N_MATCH} matches in column(s) {crowded.tolist()}, "
+                  "the answer is garbled there")
+        band = band[rank < TOP_K_PER_BAND]
+
+        room = k - selected.sum()
+        if len(band) > room:
+            band = band[np.lexsort(payloads[band].T[::-1])[:room]]
+        selected[band] = True
+    return selected
+
+def scanned_batches(params, n_queries, n_batches):
+    """
+    The batches that the server scans for the queries of query.bin, sorted.
+    The server answers these queries in one pass over the union of their
+    probe lists, or over all the batches if some query has no probe list
+    (see ivf.h).
+    """
+    probes = []
+    for q in range(n_queries):
+        probe_file = query_file(params.iodir() / "encrypted", "probe", q,
+                                n_queries)
+        if not probe_file.exists():
+            return np.arange(n_batches)
+        probes.append(np.fromfile(probe_file, dtype=np.int32))
+    return np.unique(np.concatenate(probes)).astype(np.int64)
+
+def report_probed(q, matches, scanned):
+    """Report how many of the matches are in the scanned batches"""
+    found = np.logical_and(matches, scanned).sum()
+    recall = found / matches.sum() if matches.sum() > 0 else 1.0
+    print(f"         [harness] query {q}: the probed batches hold {found} "
+          f"of {matches.sum()} matches (recall {recall:.3f})")
+
+def projected_similarities(db, qrys, projection_file, reduced_dim,
+                           chunk=1 << 20):
+    """
+    The similarities of all the queries when the records and queries are
+    projected and normalized as in projection.h, as a matrix with a row per
+    record and a column per query. The records are projected a chunk at a
+    time, to bound the memory.
+    """
+    proj = np.fromfile(projection_file, dtype=np.float32)
+    proj = proj.reshape(reduced_dim, db.shape[1])
+
+    def project(x):
+        y = x @ proj.T
+        norms = np.linalg.norm(y, axis=1, keepdims=True)
+        return y / np.where(norms > 0, norms, 1)
+
+    pq = project(qrys)
+    sims = np.empty((len(db), len(qrys)), dtype=np.float32)
+    for i in range(0, len(db), chunk):
+        sims[i:i+chunk] = project(db[i:i+chunk]) @ pq.T
+    return sims
+
+def report_recall(q, exact, reduced):
+    """Compare the matches of the projected search to the exact ones"""
+    both = np.logical_and(exact, reduced).sum()
+    recall = both / exact.sum() if exact.sum() > 0 else 1.0
+    precision = both / reduced.sum() if reduced.sum() > 0 else 1.0
+    print(f"         [harness] query {q}: {exact.sum()} matches, the "
+          f"projected search finds {reduced.sum()}: recall {recall:.3f}, "
+          f"precision {precision:.3f}")
 
 
 if __name__ == "__main__":
@@ -14,13 +14,15 @@ from params import InstanceParams, TOY, LARGE
 
 def main():
     """
-    Generate a random query vector and write to disk
+    Generate random query vectors (one by default) and write to disk
     """
     # Parse arguments using argparse
     parser = argparse.ArgumentParser(description='Generate query for FHE benchmark.')
     parser.add_argument('size', type=int, choices=range(TOY, LARGE+1),
                         help='Dataset size (0-toy/1-small/2-medium/3-large)')
     parser.add_argument('--seed', type=int, help='Random seed for reproducibility')
+    parser.add_argument('--num_queries', type=int, default=1,
+                        help='Number of query vectors to generate (default: 1)')
     
     args = parser.parse_args()
     size = args.size
@@ -37,25 +39,30 @@ def main():
     # Get dataset directory from params
     dataset_dir = params.datadir()
 
-    # Generate a new query: First choose a random vector on the unit sphere in
-    # dimension dim, made out of float32
     rng = np.random.default_rng()
-    qry = rng.standard_normal(dim, dtype=np.float32)
+    centers = None
+    qrys = []
+    for _ in range(args.num_queries):
+        # Generate a new query: First choose a random vector on the unit
+        # sphere in dimension dim, made out of float32
+        qry = rng.standard_normal(dim, dtype=np.float32)
 
-    # With probability 50%, keep the query as the new vector qry.
-    # Otherwise, read a random center from the centers file and set the
-    # query as center + 0.3*qry.
-    if random.randint(0, 1) == 0:
-        centers_file = dataset_dir / "centers.bin"
-        centers = np.fromfile(centers_file, dtype=np.float32).reshape(-1,dim)
-        center = centers[random.randint(0, len(centers)-1)]
-        qry = center + (0.3 * qry / np.linalg.norm(qry))
+        # With probability 50%, keep the query as the new vector qry.
+        # Otherwise, read a random center from the centers file and set the
+        # query as center + 0.3*qry.
+        if random.randint(0, 1) == 0:
+            if centers is None:
+                centers_file = dataset_dir / "centers.bin"
+                centers = np.fromfile(centers_file, dtype=np.float32).reshape(-1,dim)
+            center = centers[random.randint(0, len(centers)-1)]
+            qry = center + (0.3 * qry / np.linalg.norm(qry))
 
-    qry /= np.linalg.norm(qry) # normalize to unit length
+        qry /= np.linalg.norm(qry) # normalize to unit length
+        qrys.append(qry)
 
-    # store the query to file
+    # store the queries to file, one after the other
     query_file = dataset_dir / "query.bin"
-    qry.tofile(query_file)
+    np.stack(qrys).astype(np.float32).tofile(query_file)
 
 
 if __name__ == "__main__":
@@ -25,6 +25,16 @@ def instance_name(size):
 # The payloads are vectors of 7 int16 numbers in the range [0,4095)
 PAYLOAD_DIM = 7
 
+# The answer has room for MAX_N_MATCH matches in each of its columns (as
+# getMaxNMatch in params.h)
+MAX_N_MATCH = 8
+
+# The thresholds of the top-k mode, highest first (as in params.h). Each
+# band gets an equal share of the MAX_N_MATCH matches per column, so the
+# server keeps only the first TOP_K_PER_BAND matches of a band in a column.
+TOP_K_LADDER = [0.9, 0.8, 0.7, 0.6]
+TOP_K_PER_BAND = MAX_N_MATCH // len(TOP_K_LADDER)
+
 class InstanceParams:
     """Parameters that differ for different instance sizes."""
 
@@ -39,9 +49,11 @@ class InstanceParams:
         # parameters for sizes:   toy  small   medium     large
         rec_dims =              [ 128,   128,     256,      512]
         db_sizes =              [1000, 50000, 1000000, 20000000]
+        ring_dims =             [1024, 65536,   65536,    65536]
 
         self.record_dim = rec_dims[size]
         self.db_size = db_sizes[size]
+        self.ring_dim = ring_dims[size]
 
     def get_size(self):
         """Return the instance size."""
@@ -55,6 +67,14 @@ class InstanceParams:
         """Return the number of records in the dataset."""
         return self.db_size
 
+    def get_n_slots(self):
+        """Return the number of slots, i.e. of records in a batch."""
+        return self.ring_dim // 2
+
+    def get_n_cols(self):
+        """Return the number of columns of the answer."""
+        return self.ring_dim // 128
+
     # Directory structure methods
     def subdir(self):
         """Return the submission directory of this repository."""
@@ -71,3 +91,12 @@ class InstanceParams:
     def measuredir(self):
         """Return the measurements directory path."""
         return self.rootdir / "measurements" / instance_name(self.size)
+
+def query_file(directory, stem, q, n_queries):
+    """
+    The file of the q'th query when n_queries are handled together, e.g.,
+    query_0003.bin. A single query uses just <stem>.bin, e.g., query.bin.
+    """
+    if n_queries <= 1:
+        return Path(directory) / f"{stem}.bin"
+    return Path(directory) / f"{stem}_{q:04d}.bin"
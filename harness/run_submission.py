@@ -10,9 +10,44 @@ run_submission.py - run the entire submission process, from build to verify
 import sys
 import argparse
 import subprocess
+import time
 import numpy as np
 import utils
-from params import InstanceParams, TOY, LARGE, instance_name
+from params import InstanceParams, TOY, LARGE, instance_name, query_file
+
+def start_server_daemon(exec_dir, size, io_dir, extra_args=()):
+    """
+    Start server_encrypted_compute in daemon mode, and wait until it has
+    loaded everything and is ready to accept queries, i.e. until it wrote
+    its pid to the pid file. A pid file left by an earlier daemon that
+    crashed is removed first, so it is not mistaken for the new one.
+    """
+    pid_file = io_dir / "server" / "spool" / "daemon.pid"
+    pid_file.unlink(missing_ok=True)
+    daemon = subprocess.Popen([exec_dir/"server_encrypted_compute",
+                               str(size), "--daemon", *extra_args])
+    while read_pid(pid_file) != daemon.pid:
+        if daemon.poll() is not None:
+            print("Error: server daemon exited with code", daemon.returncode)
+            sys.exit(1)
+        time.sleep(0.1)
+    return daemon
+
+def read_pid(pid_file):
+    """The pid in the pid file, or None if there is none yet"""
+    try:
+        return int(pid_file.read_text().strip())
+    except (FileNotFoundError, ValueError):
+        return None
+
+def stop_server_daemon(daemon):
+    """Ask the server daemon to exit, and wait for it"""
+    daemon.terminate()
+    try:
+        daemon.wait(timeout=60)
+    except subprocess.TimeoutExpired:
+        daemon.kill()
+        daemon.wait()
 
 def main():
     """
@@ -28,9 +63,66 @@ def main():
                         help='Random seed for dataset and query generation')
     parser.add_argument('--count_only', action='store_true',
                         help='Only count # of matches, do not return payloads')
+    parser.add_argument('--daemon', action='store_true',
+                        help='Keep the server running across runs, so keys '
+                             'and dataset are loaded only once')
+    parser.add_argument('--num_queries', type=int, default=1,
+                        help='Number of queries that the server answers '
+                             'together in one pass over the dataset '
+                             '(default: 1)')
+    parser.add_argument('--plaintext_db', action='store_true',
+                        help='The server may see the dataset, only the '
+                             'query (and payloads) are encrypted')
+    parser.add_argument('--seeded', action='store_true',
+                        help='Encrypt the dataset with the secret key and '
+                             'a PRG seed, halving its size')
+    parser.add_argument('--ivf', action='store_true',
+                        help='Lay out the dataset as an inverted file over '
+                             'centers.bin, so each query scans only the '
+                             'batches of its nearest centers. The server '
+                             'learns which batches these are.')
+    parser.add_argument('--reduce_dim', type=int, default=0,
+                        help='Project the records and queries to this '
+                             'dimension before encrypting them, and report '
+                             'the recall/precision of doing so')
+    parser.add_argument('--probe', type=int, default=4,
+                        help='With --ivf, the number of centers to probe '
+                             'per query (default: 4)')
+    parser.add_argument('--top_k', type=int, default=0,
+                        help='Return the payloads of up to K matches from '
+                             'the best bands of a ladder of thresholds, '
+                             'rather than of all those above the threshold '
+                             '(not an exact top-k, see params.h)')
+    parser.add_argument('--thresholds', type=str, default=None,
+                        help='Comma-separated similarity thresholds, each '
+                             'query is answered for all of them in a single '
+                             'pass over the dataset (default: 0.8)')
+    parser.add_argument('--complex_slots', action='store_true',
+                        help='Pack two entries of the records in each '
+                             'slot, halving the rows of the matrix-vector '
+                             'product')
 
     args = parser.parse_args()
     size = args.size
+    if args.count_only and args.top_k > 0:
+        parser.error("--top_k returns payloads, not a count")
+    if args.top_k > 0 and args.thresholds is not None:
+        parser.error("--top_k uses its own thresholds")
+
+    # Every step that depends on the slot layout gets the reduced dimension
+    # and complex slots
+    layout_args = []
+    if args.reduce_dim > 0:
+        layout_args.extend(["--reduce_dim", str(args.reduce_dim)])
+    if args.complex_slots:
+        layout_args.append("--complex_slots")
+
+    # With several thresholds, every query gets an answer for each of them
+    threshold_args = []
+    num_thresholds = 1
+    if args.thresholds is not None:
+        threshold_args = ["--thresholds", args.thresholds]
+        num_thresholds = len(args.thresholds.split(','))
 
     # Use params.py to get instance parameters
     params = InstanceParams(size)
@@ -76,21 +168,33 @@ def main():
     utils.log_step(1, "Dataset generation")
 
     # 2. Client-side: Preprocess the dataset using exec_dir/client_preprocess_dataset
-    subprocess.run([exec_dir/"client_preprocess_dataset", str(size)], check=True)
+    cmd = [exec_dir/"client_preprocess_dataset", str(size)]
+    if args.ivf:
+        cmd.extend(["--ivf"])
+    if args.reduce_dim > 0:
+        cmd.extend(["--reduce_dim", str(args.reduce_dim)])
+    subprocess.run(cmd, check=True)
     utils.log_step(2, "Dataset preprocessing")
 
     # 3. Client-side: Generate the cryptographic keys 
     # Note: this does not use the rng seed above, it lets the implementation
     #   handle its own prg needs. It means that even if called with the same
     #   seed multiple times, the keys and ciphertexts will still be different.
-    cmd = [exec_dir/"client_key_generation", str(size)]
+    cmd = [exec_dir/"client_key_generation", str(size), *layout_args]
     if args.count_only:
         cmd.extend(["--count_only"])
     subprocess.run(cmd, check=True)
     utils.log_step(3, "Key Generation")
 
     # 4. Client-side: Encode and encrypt the dataset
-    subprocess.run([exec_dir/"client_encode_encrypt_db", str(size)], check=True)
+    cmd = [exec_dir/"client_encode_encrypt_db", str(size), *layout_args]
+    if args.plaintext_db:
+        cmd.extend(["--plaintext_db"])
+    if args.seeded:
+        cmd.extend(["--seeded"])
+    if args.ivf:
+        cmd.extend(["--ivf"])
+    subprocess.run(cmd, check=True)
     utils.log_step(4, "Dataset encoding and encryption")
 
     # Report size of keys and encrypted data
@@ -98,67 +202,107 @@ def main():
     utils.log_size(io_dir / "encrypted", "Encrypted database")
 
     # 5. Server-side: Preprocess the encrypted dataset using exec_dir/server_preprocess_dataset
-    subprocess.run([exec_dir/"server_preprocess_dataset", str(size)], check=True)
+    subprocess.run([exec_dir/"server_preprocess_dataset", str(size),
+                    *layout_args], check=True)
     utils.log_step(5, "Encrypted dataset preprocessing")
 
+    # Optionally start a server daemon, step 8 below hands the queries to it
+    daemon = None
+    if args.daemon:
+        daemon = start_server_daemon(exec_dir, size, io_dir, layout_args)
+        utils.log_step(5, "Server daemon startup")
+
     # Run steps 6-11 multiple times if requested
-    for run in range(args.num_runs):
-        if args.num_runs > 1:
-            print(f"\n         [harness] Run {run+1} of {args.num_runs}")
-
-        # 6. Client-side: Generate a new random query using harness/generate_query.py
-        cmd = ["python3", harness_dir/"generate_query.py", str(size)]
-        if args.seed is not None:
-            # Use a different seed for each run but derived from the base seed
-            genqry_seed = rng.integers(0,0x7fffffff)
-            cmd.extend(["--seed", str(genqry_seed)])
-        subprocess.run(cmd, check=True)
-        utils.log_step(6, "Query generation")
-
-        # 7. Client-side: Encrypt the query
-        subprocess.run([exec_dir/"client_encode_encrypt_query", str(size)], check=True)
-        utils.log_step(7, "Query encryption")
-        utils.log_size(io_dir / "encrypted" / "query.bin" , "Encrypted query")
-
-        # 8. Server-side: run exec_dir/server_encrypted_compute
-        cmd = [exec_dir/"server_encrypted_compute", str(size)]
-        if args.count_only:
-            cmd.extend(["--count_only"])
-        subprocess.run(cmd, check=True)
-        utils.log_step(8, "Encrypted computation")
-
-        # 9. Client-side: decrypt and postprocess
-        subprocess.run([exec_dir/"client_decrypt_decode", str(size)], check=True)
-        cmd = [exec_dir/"client_postprocess", str(size)]
-        if args.count_only:
-            cmd.extend(["--count_only"])
-        subprocess.run(cmd, check=True)
-        utils.log_step(9, "Result decryption and postprocessing")
-
-        # 10. Run the plaintext processing in cleartext_impl.py and verify_results
-        cmd = ["python3", harness_dir/"cleartext_impl.py", str(size)]
-        if args.count_only:
-            cmd.extend(["--count_only"])
-        subprocess.run(cmd, check=True)
-
-        # 11. Verify results
-        expected_file = params.datadir() / "expected.bin"
-        result_file = io_dir / "results.bin"
-
-        if not result_file.exists():
-            print(f"Error: Result file {result_file} not found")
-            sys.exit(1)
+    try:
+        for run in range(args.num_runs):
+            if args.num_runs > 1:
+                print(f"\n         [harness] Run {run+1} of {args.num_runs}")
+
+            # 6. Client-side: Generate a new random query using harness/generate_query.py
+            cmd = ["python3", harness_dir/"generate_query.py", str(size),
+                   "--num_queries", str(args.num_queries)]
+            if args.seed is not None:
+                # Use a different seed for each run but derived from the base seed
+                genqry_seed = rng.integers(0,0x7fffffff)
+                cmd.extend(["--seed", str(genqry_seed)])
+            subprocess.run(cmd, check=True)
+            utils.log_step(6, "Query generation")
+
+            # 7. Client-side: Encrypt the query
+            cmd = [exec_dir/"client_encode_encrypt_query", str(size),
+                   *layout_args]
+            if args.ivf:
+                cmd.extend(["--probe", str(args.probe)])
+            subprocess.run(cmd, check=True)
+            utils.log_step(7, "Query encryption")
+            utils.log_size(query_file(io_dir / "encrypted", "query", 0,
+                                      args.num_queries), "Encrypted query")
+
+            # 8. Server-side: run exec_dir/server_encrypted_compute
+            cmd = [exec_dir/"server_encrypted_compute", str(size), *layout_args]
+            if args.count_only:
+                cmd.extend(["--count_only"])
+            if args.top_k > 0:
+                cmd.extend(["--top_k"])
+            cmd.extend(threshold_args)
+            if args.num_queries > 1:
+                cmd.extend(["--num_queries", str(args.num_queries)])
+            subprocess.run(cmd, check=True)
+            utils.log_step(8, "Encrypted computation")
+
+            # 9. Client-side: decrypt and postprocess
+            cmd = [exec_dir/"client_decrypt_decode", str(size)]
+            num_answers = args.num_queries * num_thresholds
+            if num_answers > 1:
+                cmd.extend(["--num_queries", str(num_answers)])
+            subprocess.run(cmd, check=True)
+            cmd = [exec_dir/"client_postprocess", str(size), *layout_args]
+            if args.count_only:
+                cmd.extend(["--count_only"])
+            if args.top_k > 0:
+                cmd.extend(["--top_k", str(args.top_k)])
+            cmd.extend(threshold_args)
+            if args.num_queries > 1:
+                cmd.extend(["--num_queries", str(args.num_queries)])
+            subprocess.run(cmd, check=True)
+            utils.log_step(9, "Result decryption and postprocessing")
+
+            # 10. Run the plaintext processing in cleartext_impl.py and verify_results
+            cmd = ["python3", harness_dir/"cleartext_impl.py", str(size)]
+            if args.count_only:
+                cmd.extend(["--count_only"])
+            if args.reduce_dim > 0:
+                cmd.extend(["--reduce_dim", str(args.reduce_dim)])
+            if args.ivf:
+                cmd.extend(["--ivf"])
+            if args.top_k > 0:
+                cmd.extend(["--top_k", str(args.top_k)])
+            cmd.extend(threshold_args)
+            subprocess.run(cmd, check=True)
+
+            # 11. Verify results, one query (and threshold) at a time
+            for q in range(num_answers):
+                expected_file = query_file(params.datadir(), "expected", q,
+                                           num_answers)
+                result_file = query_file(io_dir, "results", q, num_answers)
+
+                if not result_file.exists():
+                    print(f"Error: Result file {result_file} not found")
+                    sys.exit(1)
 
-        cmd = ["python3", harness_dir/"verify_result.py",
-               str(expected_file), str(result_file)]
-        if args.count_only:
-            cmd.extend(["--count_only"])
-        subprocess.run(cmd, check=False)
+                cmd = ["python3", harness_dir/"verify_result.py",
+                       str(expected_file), str(result_file)]
+                if args.count_only:
+                    cmd.extend(["--count_only"])
+                subprocess.run(cmd, check=False)
 
-        # 13. Store measurements
-        run_path = params.measuredir() / f"results-{run+1}.json"
-        run_path.parent.mkdir(parents=True, exist_ok=True)
-        utils.save_run(run_path)
+            # 13. Store measurements
+            run_path = params.measuredir() / f"results-{run+1}.json"
+            run_path.parent.mkdir(parents=True, exist_ok=True)
+            utils.save_run(run_path)
+    finally:
+        if daemon is not None:
+            stop_server_daemon(daemon)
 
     print(f"\nAll steps completed for the {instance_name(size)} dataset!")
 
@@ -0,0 +1,59 @@
+#ifndef CHEBYSHEV_H_
+#define CHEBYSHEV_H_
+/// chebyshev.h - Evaluating many Chebyshev series on the same ciphertext
+//============================================================================
+// Copyright (c) 2025, Amazon Web Services
+// All rights reserved.
+//
+// This software is licensed under the terms of the Apache License v2.
+// See the file LICENSE.md for details.
+//============================================================================
+/// OpenFHE's EvalChebyshevFunction computes the Chebyshev polynomials T_i(x)
+/// that it needs for every function that it evaluates. When evaluating
+/// several functions on the same input, this module lets us compute them
+/// only once. We use a baby-step/giant-step split: for a block size k
+/// (a power of two), we compute the "baby steps" T_1,...,T_{k-1} and the
+/// "giant steps" T_k, T_2k, ..., T_Gk. Any series of degree < (G+1)*k can
+/// then be written as
+///      p(x) = q_0(x) + sum_{j=1}^G q_j(x) * T_jk(x),
+/// where each q_j is a series of degree < k. The q_j's are evaluated as
+/// linear combinations of the baby steps (no ciphertext multiplications),
+/// so evaluating p(x) takes only G ciphertext multiplications on top of
+/// the shared basis.
+///
+/// All the polynomials are over the interval [-1,1]. The depth is the same
+/// as that of EvalChebyshevFunction, e.g., 7, 8, 9 for degree 59, 119, 247.
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+#include "openfhe.h"
+
+class ChebyshevBasis {
+ public:
+  /// @brief Compute the basis for evaluating series on the ciphertext x
+  /// @param x the input, its slots must be in the interval [-1,1]
+  /// @param max_degree the highest degree of any series to be evaluated
+  /// @param n_series how many series are expected to be evaluated, this
+  ///   is only used to choose the block size that minimizes the total
+  ///   number of multiplications
+  ChebyshevBasis(const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& x,
+                 size_t max_degree, size_t n_series = 1);
+
+  /// Evaluate sum_i coeffs[i]*T_i(x), must have coeffs.size() <= max_degree+1
+  lbcrypto::Ciphertext<lbcrypto::DCRTPoly> evaluate(
+      const std::vector<double>& coeffs) const;
+
+  /// Coefficients c_0,...,c_degree such that sum_i c_i*T_i(x) interpolates
+  /// func at the degree+1 Chebyshev nodes of [-1,1]
+  static std::vector<double> coefficients(
+      const std::function<double(double)>& func, size_t degree);
+
+ private:
+  size_t max_degree;
+  size_t block;  // the block size k
+  std::vector<lbcrypto::Ciphertext<lbcrypto::DCRTPoly>> baby;   // T_i, i<k
+  std::vector<lbcrypto::Ciphertext<lbcrypto::DCRTPoly>> giant;  // T_{j*k}
+};
+#endif  // ifndef CHEBYSHEV_H_
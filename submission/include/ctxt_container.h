@@ -0,0 +1,163 @@
+#ifndef CTXT_CONTAINER_H_
+#define CTXT_CONTAINER_H_
+/// ctxt_container.h - Storing many ciphertexts in one memory-mapped file
+//============================================================================
+// Copyright (c) 2025, Amazon Web Services
+// All rights reserved.
+//
+// This software is licensed under the terms of the Apache License v2.
+// See the file LICENSE.md for details.
+//============================================================================
+/// A container file holds a sequence of CKKS ciphertexts, stored as raw DCRT
+/// towers (in evaluation form) rather than via cereal serialization. It
+/// is meant to be memory-mapped by the reader, so a ciphertext is obtained
+/// by copying its towers out of the page cache, without any parsing and
+/// without opening a separate file for each ciphertext.
+///
+/// The file layout is as follows (all integers are native-endian):
+///   [0,4096):  header, with magic, #records, offset of the index, ring
+///              dimension, and the key tag shared by all the ciphertexts
+///   4096,...:  the records, each one starting at a multiple of 4096. A
+///              record holds n_components*n_towers*ring_dim 64-bit words,
+///              component-major then tower-major.
+///   at the end: the index, one RecordInfo entry per record
+///
+/// The element parameters of each ciphertext are not stored, they are taken
+/// from the CryptoContext (the first n_towers moduli of the context).
+///
+/// A container can also hold encoded CKKS plaintexts (for a server that
+/// knows the dataset, see --plaintext_db), as records with one component
+/// and the CONTAINER_PLAINTEXT flag. These have an empty key tag, so they
+/// cannot be mixed with ciphertexts in the same container.
+///
+/// Ciphertexts that were encrypted with a seed (see seeded_encryption.h)
+/// can be stored as records with the CONTAINER_SEEDED flag, that hold only
+/// the first component b followed by the 32-byte seed. The reader expands
+/// the seed back to the second component, so get() returns an ordinary
+/// ciphertext either way.
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "openfhe.h"
+#include "seeded_encryption.h"
+
+constexpr size_t CONTAINER_ALIGNMENT = 4096;  // records are page-aligned
+constexpr uint32_t CONTAINER_PLAINTEXT = 1;    // record flags
+constexpr uint32_t CONTAINER_SEEDED = 2;
+
+/// The metadata of one record in a container
+struct ContainerRecordInfo {
+  uint64_t offset;           // where the tower data starts
+  uint32_t n_components;     // 2 for a fresh ciphertext
+  uint32_t n_towers;         // the number of RNS moduli
+  uint32_t level;            // the ciphertext level
+  uint32_t noise_scale_deg;  // the degree of the scaling factor
+  uint32_t slots;            // number of CKKS slots
+  uint32_t flags;            // CONTAINER_PLAINTEXT, CONTAINER_SEEDED, or 0
+  double scaling_factor;
+};
+
+/// Writing ciphertexts to a new container file. The index and header are
+/// written by close(), which must be called for the file to be valid.
+class CtxtContainerWriter {
+ public:
+  explicit CtxtContainerWriter(const std::filesystem::path& fname);
+  ~CtxtContainerWriter();
+
+  CtxtContainerWriter(const CtxtContainerWriter&) = delete;
+  CtxtContainerWriter& operator=(const CtxtContainerWriter&) = delete;
+
+  /// Append a ciphertext to the container, returns its index
+  size_t append(const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& ct);
+
+  /// Append an encoded plaintext to the container, returns its index
+  size_t append(const lbcrypto::Plaintext& pt);
+
+  /// Append a ciphertext that was encrypted by encrypt_seeded, storing
+  /// only its first component and the seed, returns its index
+  size_t append_seeded(const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& ct,
+                       const PrgSeed& seed);
+
+  /// Write the index and header and close the file. A container must
+  /// hold at least one record.
+  void close();
+
+  /// The number of bytes written so far
+  uint64_t bytes_written() const { return end_offset; }
+
+ private:
+  std::filesystem::path fname;
+  std::ofstream file;
+  std::vector<ContainerRecordInfo> index;
+  uint64_t ring_dim = 0;
+  std::string key_tag;
+  uint64_t end_offset = CONTAINER_ALIGNMENT;  // the header takes one page
+  bool closed = false;
+
+  size_t append_record(const std::vector<lbcrypto::DCRTPoly>& elems,
+                       const std::string& tag, ContainerRecordInfo info,
+                       const PrgSeed* seed = nullptr);
+};
+
+/// Reading ciphertexts from a memory-mapped container file. The get method
+/// only reads the mapped memory, so it can be called concurrently.
+class CtxtContainerReader {
+ public:
+  CtxtContainerReader(const lbcrypto::CryptoContext<lbcrypto::DCRTPoly>& cc,
+                      const std::filesystem::path& fname);
+  ~CtxtContainerReader();
+
+  CtxtContainerReader(const CtxtContainerReader&) = delete;
+  CtxtContainerReader& operator=(const CtxtContainerReader&) = delete;
+
+  /// The number of ciphertexts in the container
+  size_t size() const { return index.size(); }
+
+  /// The metadata of record #idx
+  const ContainerRecordInfo& info(size_t idx) const { return index.at(idx); }
+
+  /// The number of bytes of tower data (and seed) in record #idx
+  uint64_t record_bytes(size_t idx) const;
+
+  /// Is record #idx a plaintext rather than a ciphertext
+  bool is_plaintext(size_t idx) const {
+    return (index.at(idx).flags & CONTAINER_PLAINTEXT) != 0;
+  }
+
+  /// Is record #idx a ciphertext stored as a first component and a seed
+  bool is_seeded(size_t idx) const {
+    return (index.at(idx).flags & CONTAINER_SEEDED) != 0;
+  }
+
+  /// Build ciphertext #idx from the tower data in the file, expanding the
+  /// seed if it was stored with one
+  lbcrypto::Ciphertext<lbcrypto::DCRTPoly> get(size_t idx) const;
+
+  /// Build plaintext #idx from the tower data in the file
+  lbcrypto::Plaintext get_plaintext(size_t idx) const;
+
+  /// Ask the kernel to read the whole file into the page cache and keep
+  /// it there, for a process that will use the ciphertexts many times
+  void keep_resident() const;
+
+ private:
+  lbcrypto::CryptoContext<lbcrypto::DCRTPoly> cc;
+  std::filesystem::path fname;
+  const uint8_t* base = nullptr;  // the mapped file
+  size_t file_size = 0;
+  uint64_t ring_dim = 0;
+  std::string key_tag;
+  std::vector<ContainerRecordInfo> index;
+
+  // element parameters for the different numbers of towers in the file
+  std::map<uint32_t, std::shared_ptr<lbcrypto::DCRTPoly::Params>> params;
+
+  std::vector<lbcrypto::DCRTPoly> read_elements(size_t idx) const;
+};
+#endif  // ifndef CTXT_CONTAINER_H_
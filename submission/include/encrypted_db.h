@@ -0,0 +1,139 @@
+#ifndef ENCRYPTED_DB_H_
+#define ENCRYPTED_DB_H_
+/// encrypted_db.h - The on-disk layout of the encrypted dataset
+//============================================================================
+// Copyright (c) 2025, Amazon Web Services
+// All rights reserved.
+//
+// This software is licensed under the terms of the Apache License v2.
+// See the file LICENSE.md for details.
+//============================================================================
+/// The dataset is encrypted in batches of N_SLOTS records, batch #b is
+/// stored in the directory <dir>/batchNNNN (with NNNN=b). Each batch
+/// directory has two ciphertext containers (see ctxt_container.h):
+///   rows.ctx:     RECORD_DIM ciphertexts, the i'th one holds the i'th
+///                 coordinate of all the records in the batch
+///   payloads.ctx: PAYLOAD_DIM ciphertexts, the j'th one holds the j'th
+///                 payload slot of all the records in the batch
+///
+/// When the server is allowed to see the dataset (client_encode_encrypt_db
+/// with --plaintext_db), rows.ctx holds encoded plaintexts rather than
+/// ciphertexts. Only the query is then kept private, the payloads are
+/// still encrypted.
+///
+/// With --seeded, the client encrypts with the secret key and the
+/// containers hold seeded records (see seeded_encryption.h), about half
+/// the size. server_preprocess_dataset expands them, so the containers
+/// under the server's own directory always hold full ciphertexts.
+///
+/// A batch directory is complete only once it also has a file named "done",
+/// which client_encode_encrypt_db creates after both containers are written
+/// and closed. These markers let several processes encrypt disjoint ranges
+/// of batches into the same directory, and let an interrupted run skip the
+/// batches that it already finished. The marker holds a stamp (the key
+/// tag, a digest of the dataset and of the inverted-file order and
+/// projection if used, and the layout options), so batches left over from
+/// a run with other keys, other inputs, or another layout do not count as
+/// done.
+
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "openfhe.h"
+#include "params.h"
+#include "ctxt_container.h"
+
+constexpr char ROWS_CONTAINER[] = "rows.ctx";
+constexpr char PAYLOADS_CONTAINER[] = "payloads.ctx";
+constexpr char BATCH_DONE_MARKER[] = "done";
+
+/// The directory that holds batch #batch
+inline fs::path batch_dir(const fs::path& dir, int batch) {
+  std::stringstream ss;
+  ss << std::setw(4) << std::setfill('0') << batch;
+  return dir / ("batch" + ss.str());
+}
+
+/// Is batch #batch under dir complete, with the given stamp
+inline bool batch_done(const fs::path& dir, int batch,
+                       const std::string& stamp) {
+  std::ifstream file(batch_dir(dir, batch) / BATCH_DONE_MARKER);
+  std::string line;
+  return file.is_open() && std::getline(file, line) && line == stamp;
+}
+
+/// Mark batch #batch under dir as complete, after its containers are closed
+inline void mark_batch_done(const fs::path& dir, int batch,
+                            const std::string& stamp) {
+  auto marker = batch_dir(dir, batch) / BATCH_DONE_MARKER;
+  std::ofstream file(marker);
+  if (!file.is_open() || !(file << stamp << '\n')) {
+    throw std::runtime_error("Cannot write " + marker.string());
+  }
+}
+
+/// Read access to an encrypted dataset on disk. The containers are all
+/// memory-mapped when the object is constructed, and the get methods can
+/// be called concurrently.
+class EncryptedDB {
+ private:
+  std::vector<std::unique_ptr<CtxtContainerReader>> rows;
+  std::vector<std::unique_ptr<CtxtContainerReader>> payloads;
+
+ public:
+  /// Map the containers of batches 0,...,n_batches-1 under dir
+  EncryptedDB(const lbcrypto::CryptoContext<lbcrypto::DCRTPoly>& cc,
+              const fs::path& dir, int n_batches) {
+    for (int b = 0; b < n_batches; b++) {
+      auto bdir = batch_dir(dir, b);
+      rows.push_back(
+          std::make_unique<CtxtContainerReader>(cc, bdir / ROWS_CONTAINER));
+      payloads.push_back(
+          std::make_unique<CtxtContainerReader>(cc, bdir / PAYLOADS_CONTAINER));
+    }
+  }
+
+  int n_batches() const { return rows.size(); }
+
+  /// Keep all the containers in memory, see CtxtContainerReader
+  void keep_resident() const {
+    for (const auto& r : rows) {
+      r->keep_resident();
+    }
+    for (const auto& p : payloads) {
+      p->keep_resident();
+    }
+  }
+
+  /// Are the rows stored as plaintexts rather than ciphertexts
+  bool plaintext_rows() const {
+    return !rows.empty() && rows[0]->size() > 0 && rows[0]->is_plaintext(0);
+  }
+
+  /// The i'th row ciphertext of a batch
+  lbcrypto::Ciphertext<lbcrypto::DCRTPoly> get_row(int batch, int i) const {
+    return rows.at(batch)->get(i);
+  }
+
+  /// The i'th row of a batch, when the rows are stored as plaintexts
+  lbcrypto::Plaintext get_row_plaintext(int batch, int i) const {
+    return rows.at(batch)->get_plaintext(i);
+  }
+
+  /// The size of the j'th payload ciphertext of a batch, in bytes
+  uint64_t payload_bytes(int batch, int j) const {
+    return payloads.at(batch)->record_bytes(j);
+  }
+
+  /// The j'th payload ciphertext of a batch
+  lbcrypto::Ciphertext<lbcrypto::DCRTPoly> get_payload(int batch,
+                                                       int j) const {
+    return payloads.at(batch)->get(j);
+  }
+};
+#endif  // ifndef ENCRYPTED_DB_H_
@@ -0,0 +1,93 @@
+#ifndef IVF_H_
+#define IVF_H_
+/// ivf.h - Scanning only the batches near the query (inverted-file mode)
+//============================================================================
+// Copyright (c) 2025, Amazon Web Services
+// All rights reserved.
+//
+// This software is licensed under the terms of the Apache License v2.
+// See the file LICENSE.md for details.
+//============================================================================
+/// By default the server computes the similarity of the query with every
+/// record. When the dataset is clustered around known centers (the file
+/// centers.bin next to db.bin), the client can lay it out as an inverted
+/// file instead:
+///
+///   client_preprocess_dataset --ivf assigns every record to the center
+///     with the largest inner product, and writes under the dataset
+///     directory the order of the records when sorted by their center
+///     (ivf_order.bin, uint32 record indexes), and where the list of every
+///     center starts in that order (ivf_lists.bin, n_centers+1 uint64s).
+///   client_encode_encrypt_db --ivf encrypts the records in that order, so
+///     the list of each center is a contiguous run of slots, spanning one
+///     batch or a few consecutive ones.
+///   client_encode_encrypt_query --probe K finds the K centers nearest to
+///     each query and writes, next to the query ciphertext, the list of
+///     batches that hold their records (probe.bin for query.bin, etc.).
+///   server_encrypted_compute scans only the batches on the probe lists
+///     of its queries (all of them if a query has no probe list). If the
+///     lists are all empty, it scans nothing and answers with no matches.
+///
+/// The answer is a sum over the scanned batches, so nothing changes on the
+/// way back to the client. Matches whose records were assigned to a center
+/// that was not probed are lost, so this trades recall for time: a larger
+/// K finds more of them and scans more batches.
+///
+/// LEAKAGE: The probe lists are sent in the clear. The server does not
+/// learn the centers, the records, or the query, but it does learn which
+/// batches each query touches, i.e. which region of the dataset the query
+/// is near. It can tell when two queries are near each other, and over
+/// many queries it can learn which batches hold similar records. Hiding
+/// the probed batches would need PIR over the batches or an encrypted
+/// selector, which costs about as much as scanning them all, so this mode
+/// is only meant for deployments where that leakage is acceptable.
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <vector>
+
+constexpr char IVF_ORDER_FILE[] = "ivf_order.bin";
+constexpr char IVF_LISTS_FILE[] = "ivf_lists.bin";
+
+/// For each of the n_records records (of dimension dim, one after the
+/// other), the index of the center with the largest inner product
+std::vector<uint32_t> nearest_centers(
+    const float* records, size_t n_records, size_t dim,
+    const std::vector<std::vector<float>>& centers);
+
+/// The K centers with the largest inner product with qry, best first
+std::vector<uint32_t> nearest_centers(
+    const std::vector<float>& qry,
+    const std::vector<std::vector<float>>& centers, size_t K);
+
+/// Sort the records by their center (keeping the original order within
+/// each list). Returns the order, and sets offsets[c] to the position of
+/// the first record of center c in it, with offsets[n_centers]=n_records.
+std::vector<uint32_t> sort_by_center(const std::vector<uint32_t>& assignment,
+                                     size_t n_centers,
+                                     std::vector<uint64_t>& offsets);
+
+/// Read and write the files ivf_order.bin and ivf_lists.bin
+void write_ivf(const std::filesystem::path& dir,
+               const std::vector<uint32_t>& order,
+               const std::vector<uint64_t>& offsets);
+std::vector<uint32_t> read_ivf_order(const std::filesystem::path& dir);
+std::vector<uint64_t> read_ivf_lists(const std::filesystem::path& dir);
+
+/// The batches (sorted, without duplicates) that hold the lists of the
+/// given centers, when each batch holds records_per_batch records
+std::vector<int> batches_of_lists(const std::vector<uint32_t>& lists,
+                                  const std::vector<uint64_t>& offsets,
+                                  size_t records_per_batch);
+
+/// The probe list that goes with a query ciphertext, e.g. probe.bin for
+/// query.bin and probe_0003.bin for query_0003.bin
+std::filesystem::path probe_file(const std::filesystem::path& query);
+
+/// Read and write a probe list, as int32 batch indexes. read_probe returns
+/// nothing if there is no such file.
+void write_probe(const std::filesystem::path& fname,
+                 const std::vector<int>& batches);
+std::optional<std::vector<int>> read_probe(const std::filesystem::path& fname);
+#endif  // ifndef IVF_H_
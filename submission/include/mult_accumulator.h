@@ -0,0 +1,109 @@
+#ifndef MULT_ACCUMULATOR_H_
+#define MULT_ACCUMULATOR_H_
+/// mult_accumulator.h - Fused multiply-accumulate of ciphertext products
+//============================================================================
+// Copyright (c) 2025, Amazon Web Services
+// All rights reserved.
+//
+// This software is licensed under the terms of the Apache License v2.
+// See the file LICENSE.md for details.
+//============================================================================
+/// The matrix-vector product sums up many products of ciphertexts (or of a
+/// ciphertext and a plaintext), all at the same level and scale. Computing
+/// them as acc += EvalMultNoRelin(a,b) allocates a new three-component
+/// ciphertext for every product, only to add it to acc and throw it away.
+///
+/// A MultAccumulator computes the first product with OpenFHE, which sets the
+/// level, scale, etc. of the sum. Every later product whose inputs have the
+/// same level and scale as the first one is added to the sum in place, one
+/// RNS tower at a time: For a=(a0,a1), b=(b0,b1), each coefficient gets
+///      acc0 += a0*b0,   acc1 += a0*b1 + a1*b0,   acc2 += a1*b1
+/// Products whose inputs do not match (e.g., they would need a rescale
+/// first) fall back to EvalMultNoRelin and EvalAddInPlace. Since that may
+/// change the level or scale of the sum, all the products after it are
+/// then computed and added with OpenFHE too.
+///
+/// The sums are kept unreduced as 128-bit integers: the low 64 bits in the
+/// ciphertext itself and the high 64 bits in a side array. With a tower
+/// modulus q, each step adds at most 2(q-1)^2 to a coefficient, so about
+/// 2^127/q^2 steps fit before the sum must be reduced mod q. For the 42-
+/// and 57-bit moduli that we use this is more than the RECORD_DIM products
+/// of a batch, so get() usually does the only reduction. The price is that
+/// an accumulator takes twice its usual memory until get() is called.
+///
+/// When built with WITH_AVX512 (see CMakeLists.txt) and running on a CPU
+/// with AVX-512 IFMA, towers with a modulus below 2^52 use a vectorized
+/// kernel instead: vpmadd52luq/vpmadd52huq add the low and high 52 bits of
+/// eight products at a time, so these towers keep the sum in radix 2^52
+/// (i.e., as hi*2^52 + lo). Other towers, and other CPUs, use the scalar
+/// kernel. The choice is made once per tower when the sum is started.
+///
+/// A MultAccumulator is not thread-safe, each thread should use its own.
+
+#include <cstdint>
+#include <vector>
+
+#include "openfhe.h"
+
+class MultAccumulator {
+ public:
+  /// Add a*b to the sum, where a and b are ciphertexts
+  void add_product(const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& a,
+                   const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& b);
+
+  /// Add a*p to the sum, where a is a ciphertext and p a plaintext
+  void add_product(const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& a,
+                   const lbcrypto::Plaintext& p);
+
+  /// The sum of the products so far (not relinearized), or nullptr if
+  /// no products were added. This reduces the sum and frees the memory
+  /// that held the unreduced high words.
+  lbcrypto::Ciphertext<lbcrypto::DCRTPoly> get();
+
+  /// A tower modulus q < 2^62, with mu = floor(2^128/q) for Barrett
+  /// reduction of 128-bit values, and the radix (2^52 or 2^64) between
+  /// the low and high words of the unreduced sums of this tower
+  struct Modulus {
+    uint64_t q;
+    uint64_t mu_hi, mu_lo;
+    int radix_bits;
+  };
+
+  /// The name of the fastest kernel available on this build and CPU
+  static const char* kernel_name();
+
+ private:
+  lbcrypto::Ciphertext<lbcrypto::DCRTPoly> sum;
+
+  // The inputs that can be added in place are those with this level and
+  // noise-scale degree, and whose scaling factors multiply to sum_scale
+  bool fusable = false;
+  size_t in_level = 0;
+  size_t in_noise_scale_deg = 0;
+  double sum_scale = 0;
+  std::vector<Modulus> moduli;  // one per tower of the sum
+
+  // The high words of the unreduced sum, indexed by (component, tower,
+  // coefficient), and the number of steps that were added to them since
+  // the last reduction, out of the max_lazy that are safe for all towers
+  std::vector<uint64_t> hi;
+  size_t ring_dim = 0;
+  size_t n_lazy = 0;
+  size_t max_lazy = 0;
+
+  // Record the first product (which should have n_components components),
+  // and check if later ones can be fused
+  void start(const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& prod,
+             size_t level, size_t noise_scale_deg, size_t n_components);
+  bool matches(size_t level, size_t noise_scale_deg, double scale,
+               size_t n_towers) const;
+
+  // Add a product that was computed by OpenFHE, and stop fusing
+  void add_unfused(const lbcrypto::Ciphertext<lbcrypto::DCRTPoly>& prod);
+
+  // Make room for one more step, reducing the sum if needed
+  void reserve_step();
+  // Reduce the 128-bit sum mod q into the ciphertext, zeroing the high words
+  void reduce();
+};
+#endif  // ifndef MULT_ACCUMULATOR_H_
@@ -0,0 +1,100 @@
+#ifndef ORDERED_WRITER_H_
+#define ORDERED_WRITER_H_
+/// ordered_writer.h - Writing the results of a parallel loop in order
+//============================================================================
+// Copyright (c) 2025, Amazon Web Services
+// All rights reserved.
+//
+// This software is licensed under the terms of the Apache License v2.
+// See the file LICENSE.md for details.
+//============================================================================
+/// This is the mirror image of the Prefetcher (see prefetch.h): producers
+/// running in several threads compute items #0,1,2,... (e.g., ciphertexts),
+/// and hand over to put(idx,job) a job that writes item #idx. A single writer
+/// thread runs these jobs strictly in the order of their indexes, so the
+/// items can be appended to a file as they become ready, while the
+/// producers go on to compute the next ones.
+///
+/// The queue is bounded: put(idx,...) blocks while idx is depth or more
+/// ahead of the next job to be written, so at most depth finished items
+/// are held in memory. As with the Prefetcher, each index must be put
+/// exactly once, and the smallest index not yet put must eventually be put
+/// by some producer that is not blocked (e.g., parallel_for hands out its
+/// iterations in increasing order).
+///
+/// The object also keeps statistics that show whether the producers wait
+/// for the writer (write bound) or the writer waits for the producers
+/// (compute bound).
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+class OrderedWriter {
+ public:
+  using Job = std::function<void()>;
+
+  /// Statistics about the queue, reported by get_stats()
+  struct Stats {
+    size_t n_written = 0;          // how many jobs were written so far
+    double avg_depth = 0;          // avg # of waiting jobs upon put()
+    size_t n_producer_stalls = 0;  // # of times put() found the queue full
+    double producer_stall_secs = 0;
+    size_t n_writer_stalls = 0;    // # of times the writer had to wait
+    double writer_stall_secs = 0;
+  };
+
+  /// @brief Start the writer thread
+  /// @param n_items The number of jobs, with indexes 0,...,n_items-1
+  /// @param depth The maximum # of jobs that were put and not yet written
+  OrderedWriter(size_t n_items, size_t depth);
+
+  /// Stop the writer (if still running) and wait for it, jobs that were
+  /// not written by then are dropped
+  ~OrderedWriter();
+
+  OrderedWriter(const OrderedWriter&) = delete;
+  OrderedWriter& operator=(const OrderedWriter&) = delete;
+
+  /// Hand over job #idx, waiting for space in the queue if needed. If a
+  /// job failed, then the exception that it threw is re-thrown here.
+  void put(size_t idx, Job job);
+
+  /// Stop the writer because a producer failed (and so some index will
+  /// never be put), put() and finish() re-throw e from now on
+  void fail(std::exception_ptr e);
+
+  /// Wait for all the jobs to be written. If a job failed, then the
+  /// exception that it threw is re-thrown here.
+  void finish();
+
+  Stats get_stats() const;
+
+  /// A one-line human-readable summary of the statistics
+  std::string report() const;
+
+ private:
+  const size_t n_items;
+  const size_t depth;
+
+  mutable std::mutex mtx;
+  std::condition_variable ready_cv;  // signals the writer
+  std::condition_variable space_cv;  // signals the producers
+  std::map<size_t, Job> ready;
+  size_t next_to_write = 0;
+  bool stopping = false;
+  std::exception_ptr error = nullptr;
+
+  // Raw statistics, protected by mtx
+  size_t depth_sum = 0;
+  size_t n_put = 0;
+  Stats stats;
+
+  std::thread writer;
+  void writer_loop();
+};
+#endif  // ifndef ORDERED_WRITER_H_
@@ -0,0 +1,214 @@
+#ifndef PARALLEL_H_
+#define PARALLEL_H_
+/// parallel.h - Spreading independent ciphertext operations across cores
+//============================================================================
+// Copyright (c) 2025, Amazon Web Services
+// All rights reserved.
+//
+// This software is licensed under the terms of the Apache License v2.
+// See the file LICENSE.md for details.
+//============================================================================
+/// OpenFHE already parallelizes every single operation over the RNS towers
+/// of its input, using OpenMP. That works well for one large operation, but
+/// a ciphertext has only a few dozen towers, so for loops over many
+/// independent ciphertexts it is better to split the cores between the loop
+/// iterations. The parallel_for below runs min(n,T) iterations at a time
+/// (where T is the configured number of threads), and lets each of them use
+/// T/min(n,T) threads for OpenFHE's own tower-level loops. When there are
+/// more iterations than threads each iteration is single-threaded inside,
+/// and when there is just one iteration all the threads go to OpenFHE.
+///
+/// The parallel_for_stealing variant is meant for fewer, heavier iterations
+/// (such as polynomial evaluations), see below.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace parallel_detail {
+inline int& configured_threads() {
+  static int n_threads = 0;  // 0 means all the available cores
+  return n_threads;
+}
+
+// A worker's queue of iteration indexes for parallel_for_stealing. The
+// owner takes from the front, other workers steal from the back.
+class WorkQueue {
+  std::mutex mtx;
+  std::deque<int> items;
+
+ public:
+  void push_back(int i) { items.push_back(i); }
+  bool pop_front(int& i) {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (items.empty()) {
+      return false;
+    }
+    i = items.front();
+    items.pop_front();
+    return true;
+  }
+  bool steal_back(int& i) {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (items.empty()) {
+      return false;
+    }
+    i = items.back();
+    items.pop_back();
+    return true;
+  }
+};
+}  // namespace parallel_detail
+
+/// Returns the number of threads that parallel_for uses
+inline int get_num_threads() {
+  int n = parallel_detail::configured_threads();
+  if (n > 0) {
+    return n;
+  }
+#ifdef _OPENMP
+  return omp_get_num_procs();
+#else
+  return std::max(1U, std::thread::hardware_concurrency());
+#endif
+}
+
+/// Set the number of threads to use, n<=0 means all the available cores.
+/// This also sets the number of threads that OpenFHE uses outside of
+/// parallel_for loops.
+inline void set_num_threads(int n) {
+  parallel_detail::configured_threads() = std::max(n, 0);
+#ifdef _OPENMP
+  omp_set_num_threads(get_num_threads());
+#endif
+}
+
+/// Run func(i) for all 0 <= i < n, where different iterations may run
+/// concurrently. Iterations are handed out dynamically and in increasing
+/// order. If any of them throws, the first exception is re-thrown after
+/// all the others are done.
+template <typename Func>
+void parallel_for(int n, Func func) {
+  int n_threads = get_num_threads();
+  int n_outer = std::min(n, n_threads);
+  if (n_outer <= 1) {  // nothing to split, let OpenFHE use all the threads
+    for (int i = 0; i < n; i++) {
+      func(i);
+    }
+    return;
+  }
+#ifdef _OPENMP
+  int n_inner = std::max(1, n_threads / n_outer);  // threads per iteration
+  int saved_levels = omp_get_max_active_levels();
+  omp_set_max_active_levels(2);  // so OpenFHE can use the n_inner threads
+
+  std::exception_ptr error = nullptr;
+#pragma omp parallel for num_threads(n_outer) schedule(dynamic)
+  for (int i = 0; i < n; i++) {
+    omp_set_num_threads(n_inner);  // applies to nested (OpenFHE) regions
+    try {
+      func(i);
+    } catch (...) {
+#pragma omp critical(parallel_for_error)
+      if (error == nullptr) {
+        error = std::current_exception();
+      }
+    }
+  }
+  omp_set_max_active_levels(saved_levels);
+  if (error != nullptr) {
+    std::rethrow_exception(error);
+  }
+#else
+  for (int i = 0; i < n; i++) {
+    func(i);
+  }
+#endif
+}
+
+/// Run func(i) for all 0 <= i < n, with a work-stealing scheduler. This is
+/// meant for a few heavy iterations, where parallel_for's static split of
+/// the threads leaves cores idle: once some workers run out of iterations,
+/// the ones still running give OpenFHE more threads.
+///
+/// There are W=min(n,T) worker threads, each starting with a contiguous
+/// range of the iterations in its own queue. A worker that empties its
+/// queue steals from the back of the others, and exits when they are all
+/// empty. Before each iteration the worker sets the number of threads that
+/// OpenFHE may use to T/(# of workers still active), so there are never
+/// more than T threads busy at once. If any iteration throws, the first
+/// exception is re-thrown after all the others are done.
+template <typename Func>
+void parallel_for_stealing(int n, Func func) {
+  int n_threads = get_num_threads();
+  int n_workers = std::min(n, n_threads);
+  if (n_workers <= 1) {  // nothing to split, let OpenFHE use all the threads
+    for (int i = 0; i < n; i++) {
+      func(i);
+    }
+    return;
+  }
+
+  std::vector<parallel_detail::WorkQueue> queues(n_workers);
+  for (int w = 0; w < n_workers; w++) {
+    int begin = int(int64_t(n) * w / n_workers);
+    int end = int(int64_t(n) * (w + 1) / n_workers);
+    for (int i = begin; i < end; i++) {
+      queues[w].push_back(i);
+    }
+  }
+  std::atomic<int> n_active(n_workers);
+  std::mutex error_mtx;
+  std::exception_ptr error = nullptr;
+
+  auto worker = [&](int w) {
+    int i;
+    while (true) {
+      bool found = queues[w].pop_front(i);
+      for (int v = 1; !found && v < n_workers; v++) {
+        found = queues[(w + v) % n_workers].steal_back(i);
+      }
+      if (!found) {
+        break;
+      }
+#ifdef _OPENMP
+      omp_set_num_threads(std::max(1, n_threads / n_active.load()));
+#endif
+      try {
+        func(i);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(error_mtx);
+        if (error == nullptr) {
+          error = std::current_exception();
+        }
+      }
+    }
+    n_active--;
+  };
+
+  // The calling thread is worker #0
+  std::vector<std::thread> threads;
+  threads.reserve(n_workers - 1);
+  for (int w = 1; w < n_workers; w++) {
+    threads.emplace_back(worker, w);
+  }
+  worker(0);
+  for (auto& t : threads) {
+    t.join();
+  }
+#ifdef _OPENMP
+  omp_set_num_threads(n_threads);  // restore the setting of this thread
+#endif
+  if (error != nullptr) {
+    std::rethrow_exception(error);
+  }
+}
+#endif  // ifndef PARALLEL_H_
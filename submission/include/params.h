@@ -8,6 +8,7 @@
 // This software is licensed under the terms of the Apache License v2.
 // See the file LICENSE.md for details.
 //============================================================================
+#include <algorithm>
 #include <vector>
 #include <string>
 #include <stdexcept>
@@ -25,6 +26,26 @@ constexpr int PAYLOAD_PRECISION = 16;
 // The dimension of the payload vectors (currently fixed to 8)
 constexpr int PAYLOAD_DIM = 8;
 
+// A record matches a query if their similarity is above the threshold,
+// server_encrypted_compute --thresholds can use several ones instead
+constexpr double DEFAULT_THRESHOLD = 0.8;
+
+// The thresholds of the top-k mode (--top_k), highest first. A match is
+// ranked by the band [TOP_K_LADDER[b], TOP_K_LADDER[b-1]) that holds its
+// similarity, and every band gets an equal share of the getMaxNMatch()
+// matches per column of the answer, so the number of bands must divide it
+// (see finish_query in server_encrypted_compute.cpp). This is a bounded
+// ladder, not an exact top-k:
+//   - records at or below the last threshold are never returned;
+//   - only the first getMaxNMatch()/#bands matches of a band in a column
+//     are kept, even if the dropped ones are better than those of lower
+//     bands;
+//   - within the last band that it needs, client_postprocess takes the
+//     smallest payloads, not the most similar records;
+//   - a band with more than getMaxNMatch() matches in a column garbles that
+//     column of the answer.
+inline const std::vector<double> TOP_K_LADDER = {0.9, 0.8, 0.7, 0.6};
+
 // an enum for benchmark size
 enum InstanceSize {
     TOY = 0,
@@ -43,17 +64,24 @@ inline std::string instance_name(const InstanceSize size) {
 // Parameters that differ for different instance sizes
 class InstanceParams {
     const InstanceSize size;
-    int recordDim;  // dimension of the plaintext record
+    int datasetDim; // dimension of the records in db.bin and query.bin
+    int recordDim;  // dimension of the encrypted records (see reducedDim)
     int dbSize;     // number of records in the dataset
     int ringDim;    // dimenion of the FHE ring
-    std::vector<int> degrees;  // must multiply to the record dimension
+    bool complexSlots; // two record entries per slot, see the NOTE below
+    std::vector<int> degrees;  // must multiply to getNRows()
     fs::path rootdir; // root of the submission dir structure (see below)
 
 public:
-    // Constructor
-    explicit InstanceParams(InstanceSize _size,
+    // Constructor. With reducedDim=D>0, the records and queries are
+    // projected to dimension D before they are encrypted (see the NOTE on
+    // reduction below). With complexSlots, each row ciphertext holds two
+    // entries of the records (see the NOTE on complex slots below).
+    explicit InstanceParams(InstanceSize _size, int _reducedDim = 0,
+                            bool _complexSlots = false,
                             fs::path _rootdir = fs::current_path())
-                            : size(_size), rootdir(_rootdir)
+                            : size(_size), complexSlots(_complexSlots),
+                              rootdir(_rootdir)
     {
         if (unsigned(_size) > unsigned(InstanceSize::LARGE)) {
             throw std::invalid_argument("Invalid instance size");
@@ -63,7 +91,7 @@ public:
         static const int dbSizes[] = {1000, 50000, 1000000, 20000000};
 
         ringDim = (_size == InstanceSize::TOY)? 1024 : 65536;
-        recordDim = recDims[int(_size)];
+        datasetDim = recordDim = recDims[int(_size)];
         dbSize    = dbSizes[int(_size)];
 
         // NOTE: The degrees vector specifies the shape of the tree used by
@@ -87,17 +115,69 @@ public:
             default:
                 degrees = {8, 4, 4};
         }
+
+        // NOTE: With reducedDim=D, client_preprocess_dataset fits a linear
+        // projection from the dataset dimension to D (see projection.h), and
+        // only the projected records are encrypted. D must be a power of two
+        // smaller than the dataset dimension. The replication tree keeps its
+        // depth, its largest degree is halved until the degrees multiply to
+        // D, so the keys and levels stay the same and the matrix-vector
+        // product takes D rather than datasetDim rows per batch.
+        if (_reducedDim != 0) {
+            if (_reducedDim < (1 << degrees.size()) ||
+                _reducedDim >= datasetDim ||
+                (_reducedDim & (_reducedDim - 1)) != 0) {
+                throw std::invalid_argument(
+                    "reduced dimension must be a power of two in [" +
+                    std::to_string(1 << degrees.size()) + "," +
+                    std::to_string(datasetDim) + ")");
+            }
+            recordDim = _reducedDim;
+            for (int prod = datasetDim; prod > recordDim; prod /= 2) {
+                *std::max_element(degrees.begin(), degrees.end()) /= 2;
+            }
+        }
+
+        // NOTE: With complexSlots, slot s of row ciphertext k holds the
+        // complex number x[2k] + I*x[2k+1] (for the record x in that slot),
+        // so a batch has getNRows()=recordDim/2 rows. The query is encoded
+        // the same way as (q[2k] - I*q[2k+1])/2, so its replicas multiply
+        // the rows to (q[2k]x[2k] + q[2k+1]x[2k+1])/2 + I*(...), and the
+        // sum S of these products has half the inner product in its real
+        // part. The server adds the complex conjugate, S + conj(S), which
+        // takes one key switching per batch and no level. The tree gets
+        // another halving of its largest degree, as above.
+        if (complexSlots) {
+            if (recordDim < (2 << degrees.size())) {
+                throw std::invalid_argument(
+                    "complex slots need a record dimension of at least " +
+                    std::to_string(2 << degrees.size()));
+            }
+            *std::max_element(degrees.begin(), degrees.end()) /= 2;
+        }
     }
 
     // Getters for all the parameters. There are no setters, once
     // an object is constrcuted these parameters cannot be modified.
     const InstanceSize getSize() const { return size; }
+    int getDatasetDim() const { return datasetDim; }
     int getRecordDim() const { return recordDim; }
+    bool isReduced() const { return recordDim != datasetDim; }
+    bool hasComplexSlots() const { return complexSlots; }
+    // # of row ciphertexts per batch, the degrees multiply to this
+    int getNRows() const { return complexSlots ? recordDim/2 : recordDim; }
     int getDbSize() const { return dbSize; }
     int getRingDim() const { return ringDim; }
     std::vector<int> getDegrees() const { return degrees; }
     int getNSlots() const { return ringDim/2; } // # of plaintext slots
 
+    // The options that change the slot layout of the queries and dataset,
+    // e.g. "dim=64 complex", so that programs can check that they agree
+    std::string getLayout() const {
+        return "dim=" + std::to_string(recordDim) +
+               (complexSlots ? " complex" : "");
+    }
+
     // # of ciphertexts needed to hold one column of the dataset
     int getNCtxts() const {
         return (dbSize + getNSlots() - 1) / getNSlots(); 
@@ -129,7 +209,8 @@ public:
     //  ├─io/         # Directory to hold the I/O between client & server parts
     //    ├─ toy/       # The reference implementation has subdirectories
     //       ├─ keys/       # holds the keys
-    //       └─ encrypted/  # holds the ciphertexts (split into subdirectories)
+    //       ├─ encrypted/  # holds the ciphertexts (split into subdirectories)
+    //       └─ server/     # the server's pre-processed copy of the dataset
     //    ├─ small/
     //       …
     //    ├─ medium/
@@ -141,9 +222,25 @@ public:
     fs::path iodir() const  { return rootdir/"io"/instance_name(size); }
     fs::path keydir() const { return iodir() / "keys"; }
     fs::path encdir() const { return iodir() / "encrypted"; }
+    fs::path srvdir() const { return iodir() / "server"; }
     fs::path datadir() const { 
         return rootdir/"datasets"/instance_name(size);
     }
 };
 
+// When several queries are handled together (--num_queries), each one has
+// its own files <stem>_NNNN.bin with NNNN=q, e.g., query_0003.bin. A single
+// query uses just <stem>.bin, e.g., query.bin.
+inline fs::path query_file(const fs::path& dir, const std::string& stem,
+                           int q, int n_queries) {
+    if (n_queries <= 1) {
+        return dir / (stem + ".bin");
+    }
+    std::string num = std::to_string(q);
+    if (num.size() < 4) {
+        num.insert(0, 4 - num.size(), '0');
+    }
+    return dir / (stem + "_" + num + ".bin");
+}
+
 #endif  // ifndef PARAMS_H_
\ No newline at end of file
@@ -0,0 +1,105 @@
+#ifndef PREFETCH_H_
+#define PREFETCH_H_
+/// prefetch.h - Loading dataset ciphertexts ahead of the computation
+//============================================================================
+// Copyright (c) 2025, Amazon Web Services
+// All rights reserved.
+//
+// This software is licensed under the terms of the Apache License v2.
+// See the file LICENSE.md for details.
+//============================================================================
+/// This module implements a bounded producer/consumer pipeline: a few reader
+/// threads load the ciphertexts (or plaintexts) #0,1,2,... in order, keeping
+/// at most depth of them in memory ahead of the consumers. The consumers call
+/// get(idx) to take item #idx, which blocks only if that one is not loaded yet.
+/// This way the disk reads and the deserialization overlap with the
+/// computation that uses the ciphertexts.
+///
+/// Consumers may run in several threads, but each index must be taken
+/// exactly once, and at any point the smallest index not yet taken must
+/// eventually be asked for by some consumer (e.g., each consumer thread
+/// takes its indexes in increasing order). Otherwise the pipeline may fill
+/// up with ciphertexts that nobody asks for.
+///
+/// The object also keeps statistics that show whether the consumers wait for
+/// the readers (I/O bound) or the readers wait for the consumers to free up
+/// space in the queue (compute bound).
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "openfhe.h"
+
+/// The class is a template over the type of the items, it is instantiated
+/// (in prefetch.cpp) for Ciphertext<DCRTPoly> and for Plaintext.
+template <typename T>
+class Prefetcher {
+ public:
+  using Loader = std::function<T(size_t idx)>;
+
+  /// Statistics about the queue, reported by get_stats()
+  struct Stats {
+    size_t n_taken = 0;            // how many ciphertexts were taken so far
+    double avg_depth = 0;          // avg # of ready ciphertexts upon get()
+    size_t n_consumer_stalls = 0;  // # of times get() had to wait
+    double consumer_stall_secs = 0;
+    size_t n_reader_stalls = 0;    // # of times a reader found the queue full
+    double reader_stall_secs = 0;
+  };
+
+  /// @brief Start the reader threads
+  /// @param n_items The number of ciphertexts, with indexes 0,...,n_items-1
+  /// @param load A function that loads one ciphertext, it is called from
+  ///   the reader threads so it must be safe to call concurrently
+  /// @param depth The maximum # of ciphertexts that are loaded (or being
+  ///   loaded) and not yet taken by the consumers
+  /// @param n_readers The number of reader threads
+  Prefetcher(size_t n_items, Loader load, size_t depth, int n_readers = 1);
+
+  /// Stop the readers (if still running) and wait for them to finish
+  ~Prefetcher();
+
+  Prefetcher(const Prefetcher&) = delete;
+  Prefetcher& operator=(const Prefetcher&) = delete;
+
+  /// Wait for ciphertext #idx to be loaded and hand it over to the caller.
+  /// If a reader failed to load a ciphertext, then the exception that it
+  /// got is re-thrown here.
+  T get(size_t idx);
+
+  Stats get_stats() const;
+
+  /// A one-line human-readable summary of the statistics
+  std::string report() const;
+
+ private:
+  const size_t n_items;
+  const size_t depth;
+  Loader load;
+
+  mutable std::mutex mtx;
+  std::condition_variable ready_cv;  // signals the consumers
+  std::condition_variable space_cv;  // signals the readers
+  std::map<size_t, T> ready;
+  size_t next_to_load = 0;
+  size_t in_flight = 0;  // # loaded or being loaded, but not yet taken
+  bool stopping = false;
+  std::exception_ptr error = nullptr;
+
+  // Raw statistics, protected by mtx
+  size_t depth_sum = 0;
+  Stats stats;
+
+  std::vector<std::thread> readers;
+  void reader_loop();
+};
+
+using CtxtPrefetcher = Prefetcher<lbcrypto::Ciphertext<lbcrypto::DCRTPoly>>;
+using PtxtPrefetcher = Prefetcher<lbcrypto::Plaintext>;
+#endif  // ifndef PREFETCH_H_
@@ -0,0 +1,69 @@
+#ifndef PROJECTION_H_
+#define PROJECTION_H_
+/// projection.h - Reducing the dimension of the records and queries
+//============================================================================
+// Copyright (c) 2025, Amazon Web Services
+// All rights reserved.
+//
+// This software is licensed under the terms of the Apache License v2.
+// See the file LICENSE.md for details.
+//============================================================================
+/// The matrix-vector product takes one row per coordinate of the records,
+/// so its cost grows linearly with the record dimension. The client can
+/// trade some accuracy for speed by projecting the records and queries to
+/// a lower dimension D before encrypting them (the reducedDim parameter,
+/// see params.h).
+///
+/// The projection is fitted by client_preprocess_dataset --reduce_dim D.
+/// It maps x to U^T x, where the columns of U are the top D eigenvectors
+/// of the (uncentered) second-moment matrix of the records, which is the
+/// D-dimensional subspace that best preserves their inner products. The
+/// projected vector is then normalized, so the inner products of the
+/// projected records and queries are cosine similarities in [-1,1], as the
+/// comparison to the threshold on the server expects.
+///
+/// Records that have most of their mass outside the subspace may lose or
+/// gain matches. cleartext_impl.py --reduce_dim expects the results of
+/// the projected search, and reports its recall and precision relative to
+/// the exact one.
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+#include "utils.h"
+
+constexpr char PROJECTION_FILE[] = "projection.bin";
+
+class Projection {
+  size_t in_dim, out_dim;
+  std::vector<float> matrix;  // out_dim rows of dimension in_dim
+
+ public:
+  Projection(size_t _in_dim, size_t _out_dim, std::vector<float> _matrix);
+
+  /// Fit the projection to dimension out_dim on (a sample of at most
+  /// max_samples of) the records in db. If retained is not null, it is set
+  /// to the fraction of the second moment that the subspace retains.
+  static Projection fit(RecordReader<float>& db, size_t in_dim,
+                        size_t out_dim, size_t max_samples = 1 << 18,
+                        double* retained = nullptr);
+
+  /// Read and write the projection matrix, as out_dim rows of in_dim
+  /// floats. read() throws if the file does not have these dimensions.
+  static Projection read(const std::filesystem::path& fname, size_t in_dim,
+                         size_t out_dim);
+  void write(const std::filesystem::path& fname) const;
+
+  /// Project and normalize n vectors of dimension in_dim, stored one after
+  /// the other, into out (n vectors of dimension out_dim)
+  void apply(const float* in, size_t n, std::vector<float>& out) const;
+  std::vector<float> apply(const std::vector<float>& v) const;
+};
+
+/// The eigenvalues and eigenvectors of the symmetric n-by-n matrix a (row
+/// major), by the cyclic Jacobi method. Returns the eigenvalues in
+/// decreasing order, and sets the rows of vecs to the matching eigenvectors.
+std::vector<double> symmetric_eigen(std::vector<double> a, size_t n,
+                                    std::vector<std::vector<double>>& vecs);
+#endif  // ifndef PROJECTION_H_
@@ -0,0 +1,83 @@
+#ifndef QUERY_SPOOL_H_
+#define QUERY_SPOOL_H_
+/// query_spool.h - Handing queries over to a long-running server process
+//============================================================================
+// Copyright (c) 2025, Amazon Web Services
+// All rights reserved.
+//
+// This software is licensed under the terms of the Apache License v2.
+// See the file LICENSE.md for details.
+//============================================================================
+/// Loading the keys and mapping the dataset can take longer than the
+/// computation itself. A server running with --daemon loads them once, then
+/// answers queries that are handed to it through a spool directory:
+///
+///   daemon.pid:  the pid of the daemon, written once it is ready to
+///                accept queries and removed when it exits
+///   <id>.req:    a request, specifying the query file, the result file,
+///                the slot layout of the query (see getLayout in params.h),
+///                and whether to only count the matches or to return the
+///                top-k ones. The daemon rejects a request whose layout is
+///                not the one that it was started with.
+///   <id>.work:   a request that the daemon is working on
+///   <id>.done:   the outcome of a request, "ok" or an error message
+///
+/// Every file is written under a temporary name and then renamed, so the
+/// other side never sees a partial file. Request ids start with a timestamp
+/// so the daemon answers them in the order they arrived.
+
+#include <sys/types.h>
+
+#include <filesystem>
+#include <optional>
+#include <string>
+
+class QuerySpool {
+ public:
+  struct Request {
+    std::string id;
+    std::filesystem::path query;   // where to read the encrypted query
+    std::filesystem::path result;  // where to write the encrypted result
+    std::string layout;            // the slot layout of the query
+    bool count_only = false;
+    bool top_k = false;
+  };
+
+  explicit QuerySpool(const std::filesystem::path& dir);
+
+  /// The pid of the daemon serving this spool, or 0 if there is none
+  pid_t daemon_pid() const;
+
+  // Client side
+
+  /// Hand a request to the daemon, returns the request id
+  std::string submit(const std::filesystem::path& query,
+                     const std::filesystem::path& result,
+                     const std::string& layout, bool count_only,
+                     bool top_k = false);
+
+  /// Wait for a request to be answered. Returns false if the daemon exited
+  /// before answering it (and the request is withdrawn), and throws if the
+  /// daemon answered with an error.
+  bool wait(const std::string& id);
+
+  // Daemon side
+
+  /// Announce this process as the daemon serving the spool. Throws if
+  /// another live process is already serving it.
+  void start_serving();
+
+  /// Remove the pid file, called when the daemon exits
+  void stop_serving();
+
+  /// Claim the oldest pending request, if any
+  std::optional<Request> next_request();
+
+  /// Report the outcome of a request, an empty error means success
+  void complete(const Request& req, const std::string& error = "");
+
+ private:
+  std::filesystem::path dir;
+  std::filesystem::path pid_file() const { return dir / "daemon.pid"; }
+};
+#endif  // ifndef QUERY_SPOOL_H_
@@ -0,0 +1,52 @@
+#ifndef SEEDED_ENCRYPTION_H_
+#define SEEDED_ENCRYPTION_H_
+/// seeded_encryption.h - Secret-key encryption with a compressed `a` part
+//============================================================================
+// Copyright (c) 2025, Amazon Web Services
+// All rights reserved.
+//
+// This software is licensed under the terms of the Apache License v2.
+// See the file LICENSE.md for details.
+//============================================================================
+/// A CKKS ciphertext is a pair (b,a) with b = m + e - a*s, where for a
+/// public-key encryption both parts look random. The client that encrypts
+/// the dataset also owns the secret key s, so it can encrypt with s instead,
+/// and then a is just a uniformly random polynomial that may as well be
+/// produced by a PRG from a short seed. Storing b and the seed rather than
+/// b and a halves the size of the encrypted dataset.
+///
+/// The PRG is the ChaCha20 block function (RFC 8439) keyed by the 256-bit
+/// seed, with a separate stream (nonce) for every RNS tower. Each tower of
+/// a is filled by rejection sampling, so it is uniform modulo its modulus.
+/// Since a is uniform, it does not matter that we view it as being in
+/// evaluation form directly.
+
+#include <array>
+#include <cstdint>
+
+#include "openfhe.h"
+
+/// A 256-bit PRG seed
+using PrgSeed = std::array<uint32_t, 8>;
+
+/// A fresh seed from the operating system's random source
+PrgSeed random_seed();
+
+/// The polynomial a that the seed expands to, with the given parameters
+lbcrypto::DCRTPoly expand_seed(
+    const PrgSeed& seed,
+    const std::shared_ptr<lbcrypto::DCRTPoly::Params>& params);
+
+/// Encrypt pt under the secret key sk, with a taken from a fresh seed,
+/// which is returned in seed. The result is an ordinary ciphertext (b,a).
+lbcrypto::Ciphertext<lbcrypto::DCRTPoly> encrypt_seeded(
+    const lbcrypto::PrivateKey<lbcrypto::DCRTPoly>& sk,
+    const lbcrypto::Plaintext& pt, PrgSeed& seed);
+
+/// Check the ChaCha20 block function against the test vector of RFC 8439,
+/// section 2.3.2, then encrypt a known plaintext at the given level with
+/// encrypt_seeded, and check that its seed expands to the stored a and
+/// that it decrypts under sk. Throws std::runtime_error if any check fails.
+void check_seeded_encryption(
+    const lbcrypto::PrivateKey<lbcrypto::DCRTPoly>& sk, uint32_t level);
+#endif  // ifndef SEEDED_ENCRYPTION_H_
@@ -8,6 +8,10 @@
 // This software is licensed under the terms of the Apache License v2.
 // See the file LICENSE.md for details.
 //============================================================================
+#include <algorithm>
+#include <complex>
+#include <cstdint>
+#include <stdexcept>
 #include <string>
 #include <filesystem>
 #include <iostream>
@@ -67,46 +71,176 @@ template<typename T> void write2disk(
   file.close();
 }
 
-/// Encode the dataset in column order: The input is an n-by-m matrix that
-/// we want to transpose, but the rows of the output cannot have dimension
-/// above n_slots. To accomodate input matrices with more than n_slots rows,
-/// the output is split into ceil(n/n_slots) matrices, each of dimension
-/// m-by-n_slots, where the rows of the last one may be padded with zeros.
+/// Reads a binary file of records, all of dimension record_dim, a chunk of
+/// consecutive records at a time. Unlike read2vecs, only the current chunk
+/// needs to be in memory, so this is what we use for the (large) dataset.
+template<typename T> class RecordReader {
+  std::ifstream file;
+  size_t record_dim;
+  size_t n_records;
+
+ public:
+  RecordReader(const std::filesystem::path& fname, size_t _record_dim)
+      : file(fname, std::ios::binary), record_dim(_record_dim) {
+    if (!file.is_open()) {
+      throw std::runtime_error("Cannot open " + fname.string() + " for read");
+    }
+    n_records = std::filesystem::file_size(fname) / (record_dim * sizeof(T));
+  }
+
+  /// The number of records in the file
+  size_t size() const { return n_records; }
+
+  /// The next read will start at record #idx
+  void seek(size_t idx) {
+    file.clear();
+    file.seekg(idx * record_dim * sizeof(T));
+  }
+
+  /// Reads the next (up to) n records into buf, one after the other, and
+  /// returns the number of records that were read
+  size_t read(std::vector<T>& buf, size_t n) {
+    buf.resize(n * record_dim);
+    file.read(reinterpret_cast<char*>(buf.data()), buf.size() * sizeof(T));
+    size_t n_read = file.gcount() / (record_dim * sizeof(T));
+    buf.resize(n_read * record_dim);
+    return n_read;
+  }
+
+  /// Reads the n records #idx[0],...,#idx[n-1] into buf, one after the
+  /// other, e.g. to go over the dataset in another order
+  void read(std::vector<T>& buf, const uint32_t* idx, size_t n) {
+    buf.resize(n * record_dim);
+    for (size_t i = 0; i < n; i++) {
+      seek(idx[i]);
+      file.read(reinterpret_cast<char*>(&buf[i * record_dim]),
+                record_dim * sizeof(T));
+      if (!file) {
+        throw std::runtime_error("RecordReader: cannot read record #" +
+                                 std::to_string(idx[i]));
+      }
+    }
+  }
+};
+
+/// Encode a batch of the dataset in column order: The input is n_records
+/// records of dimension record_dim, stored one after the other, and the
+/// output is record_dim vectors of n_slots entries, where entry k of vector
+/// j is entry j of record k (or zero if k >= n_records).
+///
+/// The copy reads rows and writes columns, so it goes over square blocks
+/// that fit in the L1 cache, rather than write a whole column of out for
+/// every record. The vectors in out are reused across calls.
 template<typename T>
-std::vector<std::vector<std::vector<double> > > transpose_matrix(
-    std::vector<std::vector<T> > &mat, size_t n_slots)
+void transpose_batch(const T* records, size_t n_records, size_t record_dim,
+                     size_t n_slots, std::vector<std::vector<double>>& out)
 {
-  // ceil( mat.size()/n_slots )
-  auto n_ctxt_per_row = (mat.size() + n_slots - 1) / n_slots;
-  auto record_dim = mat[0].size();
-
-  //  std::cout << "n_ctxt_per_row=" << n_ctxt_per_row
-  //            << ", record_dim=" << record_dim << std::endl;
-
-  // Allocate space
-  std::vector<std::vector<std::vector<double>>> transposed(n_ctxt_per_row);
-  for (auto& batch : transposed) {
-    batch.resize(record_dim);
-    for (auto& record : batch) {
-      record.assign(n_slots, 0.0);
-    }
+  if (n_records > n_slots) {
+    throw std::invalid_argument("transpose_batch: " +
+        std::to_string(n_records) + " records do not fit in " +
+        std::to_string(n_slots) + " slots");
+  }
+  out.resize(record_dim);
+  for (auto& v : out) {
+    v.assign(n_slots, 0.0);
   }
 
-  // encode in batches of n_slots records at a time
-  for (size_t i = 0; i < n_ctxt_per_row; i++) {  // go over the batches
-    // transpose the next n_slots rows in db
-    for (size_t j = 0; j < record_dim; j++) {
-      for (size_t k = 0; k < n_slots; k++) {
-        auto idx = (i * n_slots) + k;
-        if (idx < mat.size()) {
-          transposed[i][j][k] = mat[idx][j];
-        } else {
-          break;
+  constexpr size_t BLOCK = 32;  // 32x32 floats in, 32x32 doubles out
+  for (size_t k0 = 0; k0 < n_records; k0 += BLOCK) {
+    size_t k1 = std::min(k0 + BLOCK, n_records);
+    for (size_t j0 = 0; j0 < record_dim; j0 += BLOCK) {
+      size_t j1 = std::min(j0 + BLOCK, record_dim);
+      for (size_t k = k0; k < k1; k++) {
+        const T* rec = records + k * record_dim;
+        for (size_t j = j0; j < j1; j++) {
+          out[j][k] = rec[j];
         }
       }
     }
   }
-  return transposed;  // return the encoded matrix
+}
+
+/// Combine the output of transpose_batch for complex slots: vector k of
+/// out has entries[2k] + I*entries[2k+1] (see the NOTE in params.h)
+inline void pair_as_complex(const std::vector<std::vector<double>>& entries,
+                            std::vector<std::vector<std::complex<double>>>& out)
+{
+  if (entries.size() % 2 != 0) {
+    throw std::invalid_argument("pair_as_complex: an odd number of vectors");
+  }
+  out.resize(entries.size() / 2);
+  for (size_t k = 0; k < out.size(); k++) {
+    const auto& re = entries[2 * k];
+    const auto& im = entries[2 * k + 1];
+    out[k].resize(re.size());
+    for (size_t s = 0; s < re.size(); s++) {
+      out[k][s] = {re[s], im[s]};
+    }
+  }
+}
+
+/// The inner product of two float vectors of dimension dim
+inline float dot_product(const float* a, const float* b, size_t dim) {
+  float s = 0;
+#pragma omp simd reduction(+:s)
+  for (size_t k = 0; k < dim; k++) {
+    s += a[k] * b[k];
+  }
+  return s;
+}
+
+/// Returns true if the flag (e.g., "--count_only") appears on the command line
+inline bool has_flag(int argc, char* argv[], const std::string& flag) {
+  for (int i = 1; i < argc; i++) {
+    if (flag == argv[i]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/// Returns the integer following an option on the command line (e.g.,
+/// "--threads 8"), or the default value if that option does not appear.
+inline int get_int_option(int argc, char* argv[], const std::string& option,
+                          int dflt) {
+  for (int i = 1; i < argc - 1; i++) {
+    if (option == argv[i]) {
+      return std::stoi(argv[i + 1]);
+    }
+  }
+  return dflt;
+}
+
+/// Returns the string following an option on the command line (e.g.,
+/// "--batches 0:100"), or the default value if that option does not appear.
+inline std::string get_str_option(int argc, char* argv[],
+                                  const std::string& option,
+                                  const std::string& dflt) {
+  for (int i = 1; i < argc - 1; i++) {
+    if (option == argv[i]) {
+      return argv[i + 1];
+    }
+  }
+  return dflt;
+}
+
+/// Returns the comma-separated numbers following an option on the command
+/// line (e.g., "--thresholds 0.7,0.8,0.9"), or the default values if that
+/// option does not appear.
+inline std::vector<double> get_list_option(int argc, char* argv[],
+                                           const std::string& option,
+                                           const std::vector<double>& dflt) {
+  auto str = get_str_option(argc, argv, option, "");
+  if (str.empty()) {
+    return dflt;
+  }
+  std::vector<double> list;
+  for (size_t begin = 0; begin <= str.size(); ) {
+    auto comma = std::min(str.find(',', begin), str.size());
+    list.push_back(std::stod(str.substr(begin, comma - begin)));
+    begin = comma + 1;
+  }
+  return list;
 }
 
 #include <chrono>
@@ -0,0 +1,198 @@
+// chebyshev.cpp - Evaluating many Chebyshev series on the same ciphertext
+//============================================================================
+// Copyright (c) 2025, Amazon Web Services
+// All rights reserved.
+//
+// This software is licensed under the terms of the Apache License v2.
+// See the file LICENSE.md for details.
+//============================================================================
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+#include "chebyshev.h"
+
+using namespace lbcrypto;
+
+// ceil(log2(n)) for n >= 1
+static size_t ceil_log2(size_t n) {
+  size_t log = 0;
+  while ((size_t(1) << log) < n) {
+    log++;
+  }
+  return log;
+}
+
+// Computes T_{a+b} = 2*T_a*T_b - T_{a-b}, with T_{a-b}==nullptr standing
+// for T_0 = 1
+static Ciphertext<DCRTPoly> cheb_product(const Ciphertext<DCRTPoly>& t_a,
+                                         const Ciphertext<DCRTPoly>& t_b,
+                                         const Ciphertext<DCRTPoly>& t_diff) {
+  auto cc = t_a->GetCryptoContext();
+  auto prod = cc->EvalMult(t_a, t_b);
+  prod = cc->EvalAdd(prod, prod);
+  if (t_diff == nullptr) {
+    cc->EvalSubInPlace(prod, 1.0);
+  } else {
+    cc->EvalSubInPlace(prod, t_diff);
+  }
+  return prod;
+}
+
+/*******************************************************************/
+ChebyshevBasis::ChebyshevBasis(const Ciphertext<DCRTPoly>& x,
+                               size_t _max_degree, size_t n_series)
+    : max_degree(_max_degree) {
+  if (max_degree < 1) {
+    throw std::invalid_argument("ChebyshevBasis: degree must be positive");
+  }
+  // Choose the block size k=2^m. With n_baby=min(k-1,max_degree) baby steps
+  // and G giant steps, the depth is ceil(log2(n_baby))+1 for the q_j's, or
+  // m+ceil(log2(G)) for the giant steps, plus one for multiplying them.
+  // Among the blocks with the smallest depth we pick the one with the fewest
+  // multiplications: n_baby-1 + G for the basis, and G per series.
+  size_t best_depth = std::numeric_limits<size_t>::max();
+  size_t best_cost = std::numeric_limits<size_t>::max();
+  for (size_t m = 1; (size_t(1) << (m - 1)) <= max_degree; m++) {
+    size_t k = size_t(1) << m;
+    size_t n_baby = std::min(k - 1, max_degree);
+    size_t n_giant = (max_degree + k) / k - 1;  // ceil((max_degree+1)/k)-1
+    size_t depth = ceil_log2(n_baby) + 1;
+    if (n_giant > 0) {
+      depth = std::max(depth, m + ceil_log2(n_giant)) + 1;
+    }
+    size_t cost = (n_baby - 1) + n_giant + n_series * n_giant;
+    if (depth < best_depth || (depth == best_depth && cost < best_cost)) {
+      best_depth = depth;
+      best_cost = cost;
+      block = k;
+    }
+  }
+  size_t n_baby = std::min(block - 1, max_degree);
+  size_t n_giant = (max_degree + block) / block - 1;
+
+  // Baby steps: T_i = 2*T_a*T_b - T_{a-b} where a is the largest power of
+  // two below i and b=i-a, so T_i is at depth ceil(log2(i)).
+  baby.resize(n_baby + 1);  // baby[0] is null, cheb_product's marker for T_0
+  baby[1] = x;
+  for (size_t i = 2; i <= n_baby; i++) {
+    size_t a = size_t(1) << (ceil_log2(i) - 1);
+    size_t b = i - a;
+    baby[i] = cheb_product(baby[a], baby[b], baby[a - b]);
+  }
+
+  // Giant steps: T_k = 2*T_{k/2}^2 - 1, then T_jk the same way as above
+  if (n_giant > 0) {
+    giant.resize(n_giant + 1);  // giant[0] is null, marking T_0 as above
+    giant[1] = cheb_product(baby[block / 2], baby[block / 2], nullptr);
+    for (size_t j = 2; j <= n_giant; j++) {
+      size_t a = size_t(1) << (ceil_log2(j) - 1);
+      size_t b = j - a;
+      giant[j] = cheb_product(giant[a], giant[b], giant[a - b]);
+    }
+  }
+}
+
+/*******************************************************************/
+// Evaluate sum_i coeffs[i]*T_i(x)
+Ciphertext<DCRTPoly> ChebyshevBasis::evaluate(
+    const std::vector<double>& coeffs) const {
+  if (coeffs.empty() || coeffs.size() > max_degree + 1) {
+    throw std::invalid_argument("ChebyshevBasis: series degree out of range");
+  }
+  auto cc = baby[1]->GetCryptoContext();
+  size_t n_giant = giant.empty() ? 0 : giant.size() - 1;
+
+  // Split the series into blocks, using T_{jk+i} = 2*T_jk*T_i - T_{jk-i}.
+  // Going from the top down, the coefficient of T_{jk+i} is moved to q_j[i]
+  // (times two), and subtracted from the coefficient of T_{jk-i} which is
+  // in the next block down.
+  std::vector<double> c(coeffs);
+  c.resize((n_giant + 1) * block, 0.0);
+  std::vector<std::vector<double>> q(n_giant + 1,
+                                     std::vector<double>(block, 0.0));
+  for (size_t j = n_giant; j >= 1; j--) {
+    for (size_t i = block - 1; i >= 1; i--) {
+      double a = c[j * block + i];
+      q[j][i] = 2 * a;
+      c[j * block - i] -= a;
+    }
+    q[j][0] = c[j * block];
+  }
+  for (size_t i = 0; i < block; i++) {
+    q[0][i] = c[i];
+  }
+
+  // Evaluate q_j - q_j[0] as a linear combination of the baby steps,
+  // returns nullptr if q_j is a constant
+  auto eval_block = [this, &cc, &q](size_t j) -> Ciphertext<DCRTPoly> {
+    std::vector<ReadOnlyCiphertext<DCRTPoly>> terms;
+    std::vector<double> weights;
+    for (size_t i = 1; i < baby.size(); i++) {
+      if (q[j][i] != 0.0) {
+        terms.push_back(baby[i]);
+        weights.push_back(q[j][i]);
+      }
+    }
+    if (terms.empty()) {
+      return nullptr;
+    }
+    return cc->EvalLinearWSum(terms, weights);
+  };
+
+  // Multiply q_j(x) by T_jk(x) and sum up. The products of two ciphertexts
+  // are added without relinearization, and relinearized once at the end.
+  Ciphertext<DCRTPoly> products;  // sum of q_j*T_jk, not relinearized
+  Ciphertext<DCRTPoly> result = eval_block(0);
+  for (size_t j = 1; j <= n_giant; j++) {
+    auto q_j = eval_block(j);
+    if (q_j == nullptr) {  // a constant, no need for a product
+      if (q[j][0] != 0.0) {
+        auto term = cc->EvalMult(giant[j], q[j][0]);
+        result = (result == nullptr) ? term : cc->EvalAdd(result, term);
+      }
+      continue;
+    }
+    if (q[j][0] != 0.0) {
+      cc->EvalAddInPlace(q_j, q[j][0]);
+    }
+    auto term = cc->EvalMultNoRelin(q_j, giant[j]);
+    if (products == nullptr) {
+      products = term;
+    } else {
+      cc->EvalAddInPlace(products, term);
+    }
+  }
+  if (products != nullptr) {
+    cc->RelinearizeInPlace(products);
+    result = (result == nullptr) ? products : cc->EvalAdd(products, result);
+  }
+  if (result == nullptr) {  // a constant series
+    result = cc->EvalMult(baby[1], 0.0);
+  }
+  if (q[0][0] != 0.0) {
+    cc->EvalAddInPlace(result, q[0][0]);
+  }
+  return result;
+}
+
+/*******************************************************************/
+// Chebyshev interpolation at the nodes x_j = cos(pi*(j+1/2)/N), N=degree+1
+std::vector<double> ChebyshevBasis::coefficients(
+    const std::function<double(double)>& func, size_t degree) {
+  size_t n = degree + 1;
+  std::vector<double> values(n);
+  for (size_t j = 0; j < n; j++) {
+    values[j] = func(std::cos(M_PI * (j + 0.5) / n));
+  }
+  std::vector<double> coeffs(n);
+  for (size_t k = 0; k < n; k++) {
+    double sum = 0.0;
+    for (size_t j = 0; j < n; j++) {
+      sum += values[j] * std::cos(M_PI * k * (j + 0.5) / n);
+    }
+    coeffs[k] = 2.0 * sum / n;
+  }
+  coeffs[0] /= 2.0;
+  return coeffs;
+}
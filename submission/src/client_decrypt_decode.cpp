@@ -25,27 +25,33 @@ PrivateKey<DCRTPoly> read_key(InstanceParams prms);
 
 int main(int argc, char* argv[]) {
   if (argc < 2) {
-    std::cout << "Usage: " << argv[0] << " instance-size\n";
+    std::cout << "Usage: " << argv[0] << " instance-size [--num_queries Q]\n";
     std::cout << "  Instance-size: 0-TOY, 1-SMALL, 2-MEDIUM, 3-LARGE\n";
+    std::cout << "  --num_queries: # of answers to decrypt (default: 1)\n";
     return 0;
   }
   auto size = static_cast<InstanceSize>(std::stoi(argv[1]));
   InstanceParams prms(size);
+  int n_queries = get_int_option(argc, argv, "--num_queries", 1);
 
-  // Read the encrypted answer from disk
-  Ciphertext<DCRTPoly> eres;
-  auto res_file = prms.encdir()/"results.bin";
-  if (!Serial::DeserializeFromFile(res_file, eres, SerType::BINARY)) {
-    throw std::runtime_error("failed to read answer from "+res_file.string());
-  }
-
-  // Read the secret keys from disk and decrypt
-  Plaintext pt;
   auto sk = read_key(prms);
-  sk->GetCryptoContext()->Decrypt(sk, eres, &pt);  // Decrypt
-  auto slots = pt->GetRealPackedValue();           // Decode to slots
+  for (int q = 0; q < n_queries; q++) {
+    // Read the encrypted answer from disk
+    Ciphertext<DCRTPoly> eres;
+    auto res_file = query_file(prms.encdir(), "results", q, n_queries);
+    if (!Serial::DeserializeFromFile(res_file, eres, SerType::BINARY)) {
+      throw std::runtime_error("failed to read answer from "+res_file.string());
+    }
 
-  write2disk<double>(prms.iodir()/"raw-result.bin",{slots});  // write to disk
+    // Decrypt with the secret key
+    Plaintext pt;
+    sk->GetCryptoContext()->Decrypt(sk, eres, &pt);  // Decrypt
+    auto slots = pt->GetRealPackedValue();           // Decode to slots
+
+    // write to disk
+    write2disk<double>(query_file(prms.iodir(), "raw-result", q, n_queries),
+                       {slots});
+  }
   return 0;
 }
 
@@ -7,6 +7,13 @@
 // See the file LICENSE.md for details.
 //============================================================================
 #include <cassert>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <optional>
+#include <sstream>
 
 #include "openfhe.h"
 // header files needed for de/serialization
@@ -17,49 +24,128 @@
 
 #include "params.h"
 #include "utils.h"
+#include "parallel.h"
+#include "ordered_writer.h"
+#include "seeded_encryption.h"
+#include "ivf.h"
+#include "projection.h"
+#include "encrypted_db.h"
 
 using namespace lbcrypto;
 
 // Read public encryption key from disk
 PublicKey<DCRTPoly> read_keys(InstanceParams prms);
-void add_markers(std::vector<std::vector<int16_t>>& payloads);
+// Read the secret key from disk, for seeded encryption
+PrivateKey<DCRTPoly> read_secret_key(InstanceParams prms);
+std::pair<int, int> parse_range(const std::string& range, int n_batches);
+std::vector<int16_t> add_markers(const std::vector<int16_t>& payloads);
+std::string digest_files(const std::vector<std::filesystem::path>& files);
 
 int main(int argc, char* argv[]) {
   if (argc < 2) {
-    std::cout << "Usage: " << argv[0] << " instance-size\n";
+    std::cout << "Usage: " << argv[0]
+              << " instance-size [--plaintext_db] [--seeded] [--ivf]"
+              << " [--reduce_dim D] [--complex_slots]"
+              << " [--threads T] [--write_queue N] [--batches FIRST:LAST]\n";
     std::cout << "  Instance-size: 0-TOY, 1-SMALL, 2-MEDIUM, 3-LARGE\n";
+    std::cout << "  --plaintext_db: the server may see the dataset vectors,\n"
+              << "    store them as encoded plaintexts (payloads are still\n"
+              << "    encrypted)\n";
+    std::cout << "  --seeded: encrypt with the secret key and store a seed in\n"
+              << "    place of the random part of each ciphertext, which\n"
+              << "    halves the encrypted dataset (see seeded_encryption.h)\n";
+    std::cout << "  --ivf: encrypt the records in the inverted-file order of\n"
+              << "    client_preprocess_dataset --ivf (see ivf.h)\n";
+    std::cout << "  --reduce_dim: project the records to dimension D with\n"
+              << "    the projection of client_preprocess_dataset\n"
+              << "    --reduce_dim D (see projection.h)\n";
+    std::cout << "  --complex_slots: pack two entries of the records in each\n"
+              << "    slot, which halves the rows (see params.h)\n";
+    std::cout << "  --threads: # of threads to use (default: all cores)\n";
+    std::cout << "  --write_queue: max # of encrypted ciphertexts waiting to"
+              << " be written (default: 2*threads)\n";
+    std::cout << "  --batches: only encrypt batches FIRST,...,LAST-1, so that\n"
+              << "    several processes can share the work (default: all)\n";
+    std::cout << "  Batches that are already marked done are skipped, so an\n"
+              << "  interrupted run resumes where it stopped.\n";
     return 0;
   }
   auto size = static_cast<InstanceSize>(std::stoi(argv[1]));
-  InstanceParams prms(size);
+  InstanceParams prms(size, get_int_option(argc, argv, "--reduce_dim", 0),
+                      has_flag(argc, argv, "--complex_slots"));
+  bool plaintext_db = has_flag(argc, argv, "--plaintext_db");
+  bool seeded = has_flag(argc, argv, "--seeded");
+  bool ivf = has_flag(argc, argv, "--ivf");
+  set_num_threads(get_int_option(argc, argv, "--threads", 0));
+  int write_queue =
+      get_int_option(argc, argv, "--write_queue", 2 * get_num_threads());
 
   // Read the keys from storage
   auto pk = read_keys(prms);
+  PrivateKey<DCRTPoly> sk;
+  if (seeded) {
+    sk = read_secret_key(prms);
+  }
 
-  // Read the dataset matrix from storage
-  auto db = read2vecs<float>(prms.datadir()/"db.bin", prms.getRecordDim());
+  // The dataset and payloads are read one batch at a time, so only the
+  // current batch is ever in memory.
+  RecordReader<float> db(prms.datadir()/"db.bin", prms.getDatasetDim());
   assert(int(db.size())==prms.getDbSize());
-
-  // transpose the matrix, so it is in column-major order
-  auto encoded_dataset = transpose_matrix<float>(db, prms.getNSlots());
-  assert(int(encoded_dataset.size())==prms.getNCtxts());
-
-  // Read and transpose the payloads from disk (PAYLOAD_DIM=8)
-  auto payload_fname = prms.datadir()/"payloads.bin";
-  std::vector<std::vector<int16_t>> payloads =
-        read2vecs<int16_t>(payload_fname, PAYLOAD_DIM-1);
+  RecordReader<int16_t> payloads(prms.datadir()/"payloads.bin",
+                                 PAYLOAD_DIM-1);
   assert(db.size() == payloads.size());
+  size_t records_per_batch = prms.getNSlots();
 
-  // Add a marker at the beginning of each payload record, with value
-  // equals to 2*MAX_PAYLOAD_VAL*PAYLOAD_PRECISION
-  add_markers(payloads);
+  // In inverted-file mode, batch i holds the records that are in positions
+  // i*records_per_batch,... of the order from client_preprocess_dataset
+  std::vector<uint32_t> order;
+  if (ivf) {
+    order = read_ivf_order(prms.datadir());
+    if (order.size() != db.size()) {
+      throw std::runtime_error("the inverted-file order has " +
+                               std::to_string(order.size()) + " records, " +
+                               "the dataset has " + std::to_string(db.size()));
+    }
+  }
 
-  // Encode the payloads in slots in column-major order
-  auto encoded_payloads=transpose_matrix<int16_t>(payloads, prms.getNSlots());
+  // With a reduced dimension, every batch is projected after it is read
+  std::unique_ptr<Projection> projection;
+  std::vector<float> projected_batch;
+  if (prms.isReduced()) {
+    projection = std::make_unique<Projection>(Projection::read(
+        prms.datadir()/PROJECTION_FILE, prms.getDatasetDim(),
+        prms.getRecordDim()));
+  }
 
-  // scale payloads down by PAYLOAD_PRECISION
-  for (auto& mat: encoded_payloads) for (auto& v: mat) for (auto& x: v) {
-    x /= PAYLOAD_PRECISION;
+  // The batches to encrypt: those in the range that are not done yet with
+  // these keys, this layout, and the same inputs (see encrypted_db.h)
+  auto [first, last] = parse_range(
+      get_str_option(argc, argv, "--batches", ""), prms.getNCtxts());
+  std::vector<std::filesystem::path> inputs = {
+      prms.datadir()/"db.bin", prms.datadir()/"payloads.bin"};
+  if (ivf) {
+    inputs.push_back(prms.datadir()/IVF_ORDER_FILE);
+  }
+  if (prms.isReduced()) {
+    inputs.push_back(prms.datadir()/PROJECTION_FILE);
+  }
+  std::string stamp = pk->GetKeyTag() + " " + digest_files(inputs) +
+                      (plaintext_db ? " plaintext_db" : "") +
+                      (seeded ? " seeded" : "") + (ivf ? " ivf" : "") +
+                      (prms.isReduced()
+                           ? " dim=" + std::to_string(prms.getRecordDim())
+                           : "") +
+                      (prms.hasComplexSlots() ? " complex" : "");
+  std::vector<int> batches;
+  for (int i = first; i < last; i++) {
+    if (!batch_done(prms.encdir(), i, stamp)) {
+      batches.push_back(i);
+    }
+  }
+  if (int(batches.size()) < last - first) {
+    std::cout << "         [client] " << (last - first - batches.size())
+              << " of batches " << first << ".." << (last - 1)
+              << " are already done, skipping them\n";
   }
 
   // encrypt the batch-matrices and store to disk
@@ -68,42 +154,164 @@ int main(int argc, char* argv[]) {
   // at least degrees.size()-1, so encrypt them at that level to save space
   int encryption_level1 = prms.getDegrees().size() - 1;
 
+  // Plaintext rows are not adjusted by server_preprocess_dataset, so they
+  // are encoded at the level of the replicas after they are rescaled (see
+  // mat_vec_mult), which gives them the same scaling factor too
+  int plaintext_level = prms.getDegrees().size();
+
   // encrypt the batch-payload and store to disk at a low level.
   int encryption_level2 = 20;
 
+  // Every stored `a` comes from our own PRG, so check it before using it,
+  // at both of the levels that we encrypt at
+  if (seeded) {
+    if (!plaintext_db) {
+      check_seeded_encryption(sk, encryption_level1);
+    }
+    check_seeded_encryption(sk, encryption_level2);
+  }
+
+  // The rows and payloads of a batch are encoded and encrypted in
+  // parallel, and the results are written by a separate writer thread,
+  // in order, while the next ones are encrypted. The next batch is only
+  // read once all the items of this one are encrypted: reading and
+  // transposing a batch takes far less than encrypting its items, and
+  // overlapping them would keep two batches in memory. Item j of batches[k]
+  // (rows first, then payloads) has index k*items_per_batch+j in the
+  // writer. The writer state below is only touched by the writer thread.
   auto cc = pk->GetCryptoContext();
-  for (int i = 0; i < prms.getNCtxts(); i++) {  // go over the batches
-    std::stringstream ssi;
-    ssi << std::setw(4) << std::setfill('0') << i;
-    auto dir = prms.encdir() / ("batch" + ssi.str());
-    // Create the batch directory and any parent directory as needed
-    std::filesystem::create_directories(dir);
-
-    // encrypt vectors in this batch
-    for (auto j = 0; j < prms.getRecordDim(); j++) {
-      auto pt = cc->MakeCKKSPackedPlaintext(encoded_dataset[i][j], 1,
-                                            encryption_level1);
-      auto ct = cc->Encrypt(pk, pt);
-      std::stringstream ssj;
-      ssj << std::setw(4) << std::setfill('0') << j;
-      auto ct_fname = dir / ("row_" + ssj.str() + ".bin");
-      if (!Serial::SerializeToFile(ct_fname, ct, SerType::BINARY)) {
-        throw std::runtime_error("failed to write file " + ct_fname.string());
-      }
+  int n_rows = prms.getNRows();
+  int items_per_batch = n_rows + PAYLOAD_DIM;
+  OrderedWriter out(batches.size() * items_per_batch, write_queue);
+  std::unique_ptr<CtxtContainerWriter> rows, payload_cts;
+  uint64_t bytes_written = 0;
+  auto start = std::chrono::steady_clock::now();
+
+  std::vector<float> db_batch;        // the records of the current batch
+  std::vector<int16_t> payload_batch;
+  std::vector<std::vector<double>> encoded_dataset, encoded_payloads;
+  std::vector<std::vector<std::complex<double>>> complex_dataset;
+  for (size_t k = 0; k < batches.size(); k++) {  // go over the batches
+    // Read batch i and transpose it, so it is in column-major order
+    int i = batches[k];
+    size_t n;
+    if (ivf) {
+      size_t begin = i * records_per_batch;
+      n = std::min(records_per_batch, order.size() - begin);
+      db.read(db_batch, &order[begin], n);
+      payloads.read(payload_batch, &order[begin], n);
+    } else {
+      db.seek(i * records_per_batch);
+      payloads.seek(i * records_per_batch);
+      n = db.read(db_batch, records_per_batch);
+      payloads.read(payload_batch, records_per_batch);
     }
-    // encrypt payloads in this batch
-    for (size_t j = 0; j < PAYLOAD_DIM; j++) {
-      auto pt = cc->MakeCKKSPackedPlaintext(encoded_payloads[i][j], 1,
-                                            encryption_level2);
-      auto ct = cc->Encrypt(pk, pt);
-      std::stringstream ssj;
-      ssj << std::setw(4) << std::setfill('0') << j;
-      auto ct_fname = dir / ("payload_" + ssj.str() + ".bin");
-      if (!Serial::SerializeToFile(ct_fname, ct, SerType::BINARY)) {
-        throw std::runtime_error("failed to write file " + ct_fname.string());
-      }
+    if (projection != nullptr) {
+      projection->apply(db_batch.data(), n, projected_batch);
+      db_batch.swap(projected_batch);
+    }
+    transpose_batch(db_batch.data(), n, prms.getRecordDim(),
+                    prms.getNSlots(), encoded_dataset);
+    if (prms.hasComplexSlots()) {
+      pair_as_complex(encoded_dataset, complex_dataset);
+    }
+
+    // Add a marker at the beginning of each payload record, with value
+    // equals to 2*MAX_PAYLOAD_VAL*PAYLOAD_PRECISION, then transpose the
+    // payloads and scale them down by PAYLOAD_PRECISION
+    auto marked = add_markers(payload_batch);
+    transpose_batch(marked.data(), n, PAYLOAD_DIM, prms.getNSlots(),
+                    encoded_payloads);
+    for (auto& v: encoded_payloads) for (auto& x: v) {
+      x /= PAYLOAD_PRECISION;
     }
+
+    // Writing item j of this batch: the first one creates the batch
+    // directory and containers, the last one of each container closes it,
+    // and the very last one marks the batch as done
+    auto write = [&, i](int j, const Ciphertext<DCRTPoly>& ct,
+                        const Plaintext& pt,
+                        const std::optional<PrgSeed>& seed) {
+      auto dir = batch_dir(prms.encdir(), i);
+      if (j == 0) {
+        // Create the batch directory and any parent directory as needed,
+        // and remove a stale marker before overwriting the containers
+        std::filesystem::create_directories(dir);
+        std::filesystem::remove(dir / BATCH_DONE_MARKER);
+        rows = std::make_unique<CtxtContainerWriter>(dir / ROWS_CONTAINER);
+        payload_cts =
+            std::make_unique<CtxtContainerWriter>(dir / PAYLOADS_CONTAINER);
+      }
+      auto& container = (j < n_rows) ? rows : payload_cts;
+      if (pt != nullptr) {
+        container->append(pt);
+      } else if (seed.has_value()) {
+        container->append_seeded(ct, *seed);
+      } else {
+        container->append(ct);
+      }
+      if (j == n_rows - 1) {
+        rows->close();
+        bytes_written += rows->bytes_written();
+      } else if (j == items_per_batch - 1) {
+        payload_cts->close();
+        bytes_written += payload_cts->bytes_written();
+        mark_batch_done(prms.encdir(), i, stamp);
+      }
+    };
+
+    // Encrypt with the public key, or with the secret key and a seed
+    auto encrypt = [&](const Plaintext& ptxt, std::optional<PrgSeed>& seed) {
+      if (!seeded) {
+        return cc->Encrypt(pk, ptxt);
+      }
+      seed.emplace();
+      return encrypt_seeded(sk, ptxt, *seed);
+    };
+
+    // Encode row j, at the given level
+    auto encode_row = [&](int j, int level) {
+      if (prms.hasComplexSlots()) {
+        return cc->MakeCKKSPackedPlaintext(complex_dataset[j], 1, level);
+      }
+      return cc->MakeCKKSPackedPlaintext(encoded_dataset[j], 1, level);
+    };
+
+    parallel_for(items_per_batch, [&](int j) {
+      Ciphertext<DCRTPoly> ct;
+      Plaintext pt;
+      std::optional<PrgSeed> seed;
+      try {
+        if (j >= n_rows) {         // a payload
+          auto ptxt = cc->MakeCKKSPackedPlaintext(
+              encoded_payloads[j - n_rows], 1, encryption_level2);
+          ct = encrypt(ptxt, seed);
+        } else if (plaintext_db) { // an encoded row
+          pt = encode_row(j, plaintext_level);
+        } else {                   // an encrypted row
+          ct = encrypt(encode_row(j, encryption_level1), seed);
+        }
+      } catch (...) {  // release the other producers before bailing out
+        out.fail(std::current_exception());
+        throw;
+      }
+      out.put(k * items_per_batch + j,
+              [write, j, ct, pt, seed] { write(j, ct, pt, seed); });
+    });
   }
+  out.finish();
+
+  // Report the throughput
+  double secs = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+  size_t n_items = batches.size() * items_per_batch;
+  double mbytes = bytes_written / double(1 << 20);
+  std::cout << std::fixed << std::setprecision(1)
+            << "         [client] encoded/encrypted " << n_items
+            << " items in " << secs << "s (" << n_items / secs
+            << " per second), wrote " << mbytes << " MB ("
+            << mbytes / secs << " MB/s)\n";
+  std::cout << "         [client] " << out.report() << std::endl;
   return 0;
 }
 
@@ -124,11 +332,85 @@ PublicKey<DCRTPoly> read_keys(InstanceParams prms)
   return pk;
 }
 
+// Read the secret key from disk, for seeded encryption
+PrivateKey<DCRTPoly> read_secret_key(InstanceParams prms)
+{
+  PrivateKey<DCRTPoly> sk;
+  if (!Serial::DeserializeFromFile(prms.keydir()/"sk.bin",sk,SerType::BINARY)){
+    throw std::runtime_error(
+        "Failed to get secret key from " + prms.keydir().string());
+  }
+  return sk;
+}
+
+// Parse a range of batches FIRST:LAST (meaning FIRST,...,LAST-1), where
+// an empty string means all of them
+std::pair<int, int> parse_range(const std::string& range, int n_batches)
+{
+  if (range.empty()) {
+    return {0, n_batches};
+  }
+  auto colon = range.find(':');
+  if (colon == std::string::npos) {
+    throw std::invalid_argument("--batches expects FIRST:LAST, got " + range);
+  }
+  int first = std::stoi(range.substr(0, colon));
+  int last = std::stoi(range.substr(colon + 1));
+  if (first < 0 || first > last || last > n_batches) {
+    throw std::invalid_argument("--batches " + range + " is not a range in 0:"
+                                + std::to_string(n_batches));
+  }
+  return {first, last};
+}
+
 // Add a marker at the beginning of each payload record, with value
-// equals to 2*MAX_PAYLOAD_VAL*PAYLOAD_PRECISION
-void add_markers(std::vector<std::vector<int16_t>>& payloads)
+// equals to 2*MAX_PAYLOAD_VAL*PAYLOAD_PRECISION. The input has records of
+// PAYLOAD_DIM-1 entries one after the other, the output of PAYLOAD_DIM.
+std::vector<int16_t> add_markers(const std::vector<int16_t>& payloads)
+{
+    size_t n_records = payloads.size() / (PAYLOAD_DIM-1);
+    std::vector<int16_t> marked;
+    marked.reserve(n_records * PAYLOAD_DIM);
+    for (size_t i = 0; i < n_records; i++) {
+        marked.push_back(2*MAX_PAYLOAD_VAL*PAYLOAD_PRECISION);
+        auto rec = payloads.begin() + i*(PAYLOAD_DIM-1);
+        marked.insert(marked.end(), rec, rec + (PAYLOAD_DIM-1));
+    }
+    return marked;
+}
+
+// A digest of the contents of the files, as 16 hex digits. This is not a
+// cryptographic hash, it only tells apart the inputs of different runs
+// (e.g., after the dataset was regenerated). The files are read eight
+// bytes at a time, as FNV-1a does one byte at a time.
+std::string digest_files(const std::vector<std::filesystem::path>& files)
 {
-    for (auto& p: payloads) {
-        p.insert(p.begin(), 2*MAX_PAYLOAD_VAL*PAYLOAD_PRECISION);
+  constexpr uint64_t FNV_PRIME = 0x100000001b3ULL;
+  uint64_t h = 0xcbf29ce484222325ULL;  // the FNV offset basis
+  std::vector<uint64_t> buf(1 << 17);
+  for (const auto& fname : files) {
+    std::ifstream file(fname, std::ios::in | std::ios::binary);
+    if (!file.is_open()) {
+      throw std::runtime_error("Cannot open " + fname.string());
+    }
+    uint64_t total = 0;
+    while (file) {
+      file.read(reinterpret_cast<char*>(buf.data()),
+                buf.size() * sizeof(uint64_t));
+      size_t n = file.gcount();
+      if (n % sizeof(uint64_t) != 0) {  // zero-pad the last word
+        std::memset(reinterpret_cast<char*>(buf.data()) + n, 0,
+                    sizeof(uint64_t) - n % sizeof(uint64_t));
+      }
+      for (size_t i = 0; i < (n + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+           i++) {
+        h = (h ^ buf[i]) * FNV_PRIME;
+      }
+      total += n;
     }
-}
\ No newline at end of file
+    h = (h ^ total) * FNV_PRIME;  // so that the padding is not ambiguous
+  }
+  std::stringstream ss;
+  ss << std::hex << std::setw(16) << std::setfill('0') << h;
+  return ss.str();
+}
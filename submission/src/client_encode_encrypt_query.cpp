@@ -17,6 +17,8 @@
 
 #include "params.h"
 #include "utils.h"
+#include "ivf.h"
+#include "projection.h"
 
 using namespace lbcrypto;
 
@@ -25,32 +27,98 @@ PublicKey<DCRTPoly> read_keys(InstanceParams prms);
 
 int main(int argc, char* argv[]) {
   if (argc < 2) {
-    std::cout << "Usage: " << argv[0] << " instance-size\n";
+    std::cout << "Usage: " << argv[0]
+              << " instance-size [--probe K] [--reduce_dim D]"
+              << " [--complex_slots]\n";
     std::cout << "  Instance-size: 0-TOY, 1-SMALL, 2-MEDIUM, 3-LARGE\n";
+    std::cout << "  --reduce_dim: project the queries to dimension D, as\n"
+              << "    was done for the dataset (see projection.h)\n";
+    std::cout << "  --complex_slots: the dataset was encrypted with two\n"
+              << "    entries per slot (see params.h)\n";
+    std::cout << "  --probe: with a dataset in the inverted-file layout, let\n"
+              << "    the server scan only the batches of the K centers\n"
+              << "    nearest to each query. The server learns which batches\n"
+              << "    these are (see ivf.h).\n";
     return 0;
   }
   auto size = static_cast<InstanceSize>(std::stoi(argv[1]));
-  InstanceParams prms(size);
+  InstanceParams prms(size, get_int_option(argc, argv, "--reduce_dim", 0),
+                      has_flag(argc, argv, "--complex_slots"));
+  int n_probe = get_int_option(argc, argv, "--probe", 0);
 
   // Read the keys from storage
   auto pk = read_keys(prms);
   auto cc = pk->GetCryptoContext();
 
-  // Read the query vector from disk
-  auto qs = read2vecs<float>(prms.datadir()/"query.bin", prms.getRecordDim());
-  assert(qs.size()==1);
-  auto qry = qs[0];
+  // Read the query vectors from disk. There is usually just one, if there
+  // are more then each is encrypted to its own file (see query_file)
+  auto qs = read2vecs<float>(prms.datadir()/"query.bin", prms.getDatasetDim());
+  assert(qs.size()>=1);
 
-  // Encrypt the query vector, repeated to fill all the slots in a ciphertext
-  std::vector<double> slots(prms.getNSlots());
-  for (int i = 0; i < prms.getNSlots(); i++) {
-    slots[i] = qry[i % prms.getRecordDim()];
+  // The encrypted queries are projected like the dataset records, the
+  // probe lists below use the original ones (the centers are not projected)
+  auto projected = qs;
+  if (prms.isReduced()) {
+    auto projection = Projection::read(prms.datadir()/PROJECTION_FILE,
+                                       prms.getDatasetDim(),
+                                       prms.getRecordDim());
+    for (auto& v : projected) {
+      v = projection.apply(v);
+    }
   }
-  auto pt = cc->MakeCKKSPackedPlaintext(slots);
-  auto eqry = cc->Encrypt(pk, pt);  // the encrypted query vector at top level
-  auto q_file = prms.encdir()/"query.bin";
-  if (!Serial::SerializeToFile(q_file, eqry, SerType::BINARY)) {
-      throw std::runtime_error("failed to write query to "+q_file.string());
+
+  // The centers and lists of the inverted file, if probing
+  std::vector<std::vector<float>> centers;
+  std::vector<uint64_t> offsets;
+  if (n_probe > 0) {
+    centers = read2vecs<float>(prms.datadir()/"centers.bin",
+                               prms.getDatasetDim());
+    offsets = read_ivf_lists(prms.datadir());
+    if (offsets.size() != centers.size() + 1) {
+      throw std::runtime_error("the inverted file does not match the centers");
+    }
+  }
+
+  for (size_t q = 0; q < qs.size(); q++) {
+    const auto& qry = projected[q];
+
+    // Encrypt the query vector, repeated to fill all the slots in a
+    // ciphertext. With complex slots, slot i has (q[2k] - I*q[2k+1])/2
+    // for k=i%NROWS instead.
+    std::vector<double> slots(prms.getNSlots(), 0.0);
+    std::vector<std::complex<double>> complex_slots;
+    if (prms.hasComplexSlots()) {
+      complex_slots.resize(prms.getNSlots(), 0.0);
+    }
+    for (int i = 0; i < prms.getNSlots(); i++) {
+      if (prms.hasComplexSlots()) {
+        size_t k = i % prms.getNRows();
+        complex_slots[i] = {qry[2 * k] / 2.0, -qry[2 * k + 1] / 2.0};
+      } else {
+        slots[i] = qry[i % prms.getRecordDim()];
+      }
+    }
+    auto pt = prms.hasComplexSlots()
+                  ? cc->MakeCKKSPackedPlaintext(complex_slots)
+                  : cc->MakeCKKSPackedPlaintext(slots);
+    auto eqry = cc->Encrypt(pk, pt);  // the encrypted query vector at top level
+    auto q_file = query_file(prms.encdir(), "query", q, qs.size());
+    if (!Serial::SerializeToFile(q_file, eqry, SerType::BINARY)) {
+        throw std::runtime_error("failed to write query to "+q_file.string());
+    }
+
+    // The probe list of the query. Do not leave a stale one behind when
+    // not probing.
+    if (n_probe <= 0) {
+      std::filesystem::remove(probe_file(q_file));
+      continue;
+    }
+    auto batches = batches_of_lists(nearest_centers(qs[q], centers, n_probe),
+                                    offsets, prms.getNSlots());
+    write_probe(probe_file(q_file), batches);
+    std::cout << "         [client] query " << q << " probes "
+              << batches.size() << " of " << prms.getNCtxts()
+              << " batches\n";
   }
   return 0;
 }
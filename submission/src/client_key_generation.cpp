@@ -26,14 +26,21 @@ KeyPair<DCRTPoly> key_gen(const InstanceParams& prms, bool count_only);
 
 int main(int argc, char* argv[]) {
   if (argc < 2 || !std::isdigit(argv[1][0])) {
-    std::cout << "Usage: " << argv[0] << " instance-size [--count_only]\n";
+    std::cout << "Usage: " << argv[0]
+              << " instance-size [--count_only] [--reduce_dim D]"
+              << " [--complex_slots]\n";
     std::cout << "  Instance-size: 0-TOY, 1-SMALL, 2-MEDIUM, 3-LARGE\n";
+    std::cout << "  --reduce_dim: the records were projected to dimension D"
+              << " (default: no projection, see projection.h)\n";
+    std::cout << "  --complex_slots: the records were encrypted with two"
+              << " entries per slot (see params.h)\n";
     return 0;
   }
   auto size = static_cast<InstanceSize>(std::stoi(argv[1]));
-  InstanceParams prms(size);
+  InstanceParams prms(size, get_int_option(argc, argv, "--reduce_dim", 0),
+                      has_flag(argc, argv, "--complex_slots"));
 
-  bool count_only = (argc > 2 && std::string(argv[2])=="--count_only");
+  bool count_only = has_flag(argc, argv, "--count_only");
 
   // Generate fresh keys
   auto keys = key_gen(prms, count_only);
@@ -107,5 +114,12 @@ KeyPair<DCRTPoly> key_gen(const InstanceParams& prms, bool count_only)
     cc->EvalSumRowsKeyGen(keyPair.secretKey, keyPair.publicKey,
                           prms.getNCols() * PAYLOAD_DIM);
   }
+  // With complex slots, the server adds the complex conjugate of the
+  // matrix-vector product, which is the automorphism X -> X^{2N-1}
+  if (prms.hasComplexSlots()) {
+    uint32_t conj = 2 * prms.getRingDim() - 1;
+    cc->InsertEvalAutomorphismKey(
+        cc->EvalAutomorphismKeyGen(keyPair.secretKey, {conj}));
+  }
   return keyPair;
 }
@@ -12,41 +12,85 @@
 #include "utils.h"
 #include "running_sums.h"
 
-std::vector<std::vector<int16_t>>
-decode_results(const std::vector<double>& slots, int n_cols);
+// The decoded payloads of one query, as one sorted list per band of the
+// answer (a single band unless in top-k mode, see params.h)
+std::vector<std::vector<std::vector<int16_t>>>
+decode_results(const std::vector<double>& slots, int n_cols,
+               int n_bands = 1);
+
+// Up to k payloads from the best bands of the answer
+std::vector<std::vector<int16_t>> select_top_k(
+    const std::vector<std::vector<std::vector<int16_t>>>& bands, size_t k);
 
 int main(int argc, char* argv[]) {
   if (argc < 2 || !std::isdigit(argv[1][0])) {
-    std::cout << "Usage: " << argv[0] << " instance-size [--count_only]\n";
+    std::cout << "Usage: " << argv[0] << " instance-size [--count_only]"
+              << " [--num_queries Q] [--reduce_dim D]"
+              << " [--complex_slots] [--top_k K] [--thresholds T1,T2,...]\n";
     std::cout << "  Instance-size: 0-TOY, 1-SMALL, 2-MEDIUM, 3-LARGE\n";
+    std::cout << "  --num_queries: # of answers to process (default: 1)\n";
+    std::cout << "  --reduce_dim: the records were projected to dimension D"
+              << " (default: no projection, see projection.h)\n";
+    std::cout << "  --complex_slots: the records were encrypted with two"
+              << " entries per slot (see params.h)\n";
+    std::cout << "  --top_k: the server ran with --top_k, keep up to K"
+              << " matches from its best bands.\n"
+              << "    Not an exact top-k: only matches above the last"
+              << " threshold of TOP_K_LADDER, a few\n"
+              << "    per band and column, and ties broken by payload"
+              << " (see params.h)\n";
+    std::cout << "  --thresholds: the server ran with these thresholds, and"
+              << " answered each query\n"
+              << "    once per threshold\n";
     return 0;
   }
   auto size = static_cast<InstanceSize>(std::stoi(argv[1]));
-  InstanceParams prms(size);
+  InstanceParams prms(size, get_int_option(argc, argv, "--reduce_dim", 0),
+                      has_flag(argc, argv, "--complex_slots"));
 
-  bool count_only = (argc > 2 && std::string(argv[2])=="--count_only");
+  bool count_only = has_flag(argc, argv, "--count_only");
+  int n_queries = get_int_option(argc, argv, "--num_queries", 1);
+  int top_k = get_int_option(argc, argv, "--top_k", 0);
+  int n_thresholds = get_list_option(argc, argv, "--thresholds",
+                                     {DEFAULT_THRESHOLD}).size();
 
-  // Read the raw result slots from disk
-  auto vs = read2vecs<double>(prms.iodir()/"raw-result.bin",prms.getNSlots());
-  assert(vs.size()==1);
-  auto slots = vs[0];
+  // With T thresholds, every query has T answers, the one for threshold #t
+  // of query #q is number q*T+t, in both raw-result and results
+  for (int ans = 0; ans < n_queries * n_thresholds; ans++) {
+    // Read the raw result slots from disk
+    auto vs = read2vecs<double>(
+        query_file(prms.iodir(), "raw-result", ans, n_queries * n_thresholds),
+        prms.getNSlots());
+    assert(vs.size()==1);
+    auto slots = vs[0];
 
-  if (count_only) {  // Write a single integer containing the sum
-    long count = std::round(slots[0]);
-    write2disk<long>(prms.iodir()/"results.bin", {{count}});
-  } else {  // Decode the raw results to a list of playloads
-    auto res = decode_results(slots, prms.getNCols());
-    write2disk<int16_t>(prms.iodir()/"results.bin", res);
+    auto res_file = query_file(prms.iodir(), "results", ans,
+                               n_queries * n_thresholds);
+    if (count_only) {  // Write a single integer containing the sum
+      long count = std::round(slots[0]);
+      write2disk<long>(res_file, {{count}});
+    } else if (top_k > 0) {  // Keep the best matches
+      auto bands = decode_results(slots, prms.getNCols(),
+                                  TOP_K_LADDER.size());
+      write2disk<int16_t>(res_file, select_top_k(bands, top_k));
+    } else {  // Decode the raw results to a list of playloads
+      auto res = decode_results(slots, prms.getNCols())[0];
+      write2disk<int16_t>(res_file, res);
+    }
   }
   return 0;
 }
 
 // Decode the slots of the results, returning a vector of recrods
-// each a vector of PAYLOAD_DIM-1 bytes
-std::vector<std::vector<int16_t>>
-decode_results(const std::vector<double>& slots, int n_cols) {
+// each a vector of PAYLOAD_DIM-1 bytes. With n_bands>1, the matches of
+// each column are split equally among the bands, and the records of every
+// band are returned separately.
+std::vector<std::vector<std::vector<int16_t>>>
+decode_results(const std::vector<double>& slots, int n_cols,
+               int n_bands) {
   auto result_matrix = RunningSums::to_matrix_form({slots}, n_cols);
-  std::vector<std::vector<int16_t>> obtained_vals;
+  size_t per_band = result_matrix.size() / n_bands;  // slots of a band
+  std::vector<std::vector<std::vector<int16_t>>> obtained_vals(n_bands);
   for (int j = 0; j < n_cols; j++) {
     for (size_t i = 0; i < result_matrix.size(); i += PAYLOAD_DIM) {
       int marker = -1;
@@ -78,10 +122,31 @@ decode_results(const std::vector<double>& slots, int n_cols) {
           auto idx = i + ((marker + k) % PAYLOAD_DIM);
           rec[k - 1] = std::round(scale * result_matrix[idx][j]);
         }
-        obtained_vals.push_back(rec);
+        obtained_vals[i / per_band].push_back(rec);
       }
     }
   }
-  std::sort(obtained_vals.begin(), obtained_vals.end());
+  for (auto& band : obtained_vals) {
+    std::sort(band.begin(), band.end());
+  }
   return obtained_vals;
 }
+
+// The answer does not rank the matches within a band, so the last band
+// that is needed contributes its smallest payloads. The bands hold only
+// the matches that the server kept (see TOP_K_LADDER in params.h), and
+// cleartext_impl.py --top_k selects the same ones.
+std::vector<std::vector<int16_t>> select_top_k(
+    const std::vector<std::vector<std::vector<int16_t>>>& bands, size_t k) {
+  std::vector<std::vector<int16_t>> selected;
+  for (const auto& band : bands) {
+    for (const auto& rec : band) {
+      if (selected.size() == k) {
+        break;
+      }
+      selected.push_back(rec);
+    }
+  }
+  std::sort(selected.begin(), selected.end());
+  return selected;
+}
@@ -6,8 +6,93 @@
 // This software is licensed under the terms of the Apache License v2.
 // See the file LICENSE.md for details.
 //============================================================================
-//FIXME: This is logically the right place to transpose the dataset matrix,
-//  but for large datasets this will require a non-negligible additional
-//  disk space to store both the original dataset and the transposed one.
-//  Hence at least for now it is all done in client_encode_encrypt_db.
-int main() { return 0; }
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+
+#include "params.h"
+#include "utils.h"
+#include "parallel.h"
+#include "ivf.h"
+#include "projection.h"
+
+// Assign the records to the centers and write the inverted file
+void build_inverted_file(const InstanceParams& prms);
+
+// Fit the projection to the reduced dimension and write it
+void fit_projection(const InstanceParams& prms);
+
+int main(int argc, char* argv[]) {
+  if (argc < 2 || !std::isdigit(argv[1][0])) {
+    std::cout << "Usage: " << argv[0]
+              << " instance-size [--ivf] [--reduce_dim D]\n";
+    std::cout << "  Instance-size: 0-TOY, 1-SMALL, 2-MEDIUM, 3-LARGE\n";
+    std::cout << "  --ivf: assign the records to the centers in centers.bin\n"
+              << "    and write the inverted-file layout (see ivf.h). This\n"
+              << "    compares every record with every center.\n";
+    std::cout << "  --reduce_dim: fit a projection of the records to\n"
+              << "    dimension D, a power of two (see projection.h)\n";
+    return 0;
+  }
+  auto size = static_cast<InstanceSize>(std::stoi(argv[1]));
+  InstanceParams prms(size, get_int_option(argc, argv, "--reduce_dim", 0));
+  if (has_flag(argc, argv, "--ivf")) {
+    build_inverted_file(prms);
+  }
+  if (prms.isReduced()) {
+    fit_projection(prms);
+  }
+  return 0;
+}
+
+// Assign the records to centers, a chunk of records at a time. Only the
+// record order is written, not a sorted copy of the dataset, so this
+// takes no additional disk space beyond 12 bytes per record.
+void build_inverted_file(const InstanceParams& prms) {
+  auto start = std::chrono::steady_clock::now();
+  auto centers = read2vecs<float>(prms.datadir()/"centers.bin",
+                                  prms.getDatasetDim());
+  RecordReader<float> db(prms.datadir()/"db.bin", prms.getDatasetDim());
+  std::vector<uint32_t> assignment;
+  assignment.reserve(db.size());
+  std::vector<float> chunk;
+  while (size_t n = db.read(chunk, 1 << 16)) {
+    auto a = nearest_centers(chunk.data(), n, prms.getDatasetDim(), centers);
+    assignment.insert(assignment.end(), a.begin(), a.end());
+  }
+
+  std::vector<uint64_t> offsets;
+  auto order = sort_by_center(assignment, centers.size(), offsets);
+  write_ivf(prms.datadir(), order, offsets);
+
+  uint64_t longest = 0;
+  for (size_t c = 0; c < centers.size(); c++) {
+    longest = std::max(longest, offsets[c + 1] - offsets[c]);
+  }
+  double secs = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+  std::cout << std::fixed << std::setprecision(1)
+            << "         [client] assigned " << order.size()
+            << " records to " << centers.size() << " centers in " << secs
+            << "s, the longest list has " << longest << " records\n";
+}
+
+// The fraction of the second moment that the projection retains is only a
+// rough guide, cleartext_impl.py --reduce_dim reports the actual recall and
+// precision for the queries
+void fit_projection(const InstanceParams& prms) {
+  auto start = std::chrono::steady_clock::now();
+  RecordReader<float> db(prms.datadir()/"db.bin", prms.getDatasetDim());
+  double retained;
+  auto projection = Projection::fit(db, prms.getDatasetDim(),
+                                    prms.getRecordDim(), 1 << 18, &retained);
+  projection.write(prms.datadir()/PROJECTION_FILE);
+
+  double secs = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+  std::cout << std::fixed << std::setprecision(1)
+            << "         [client] projected dimension " << prms.getDatasetDim()
+            << " to " << prms.getRecordDim() << " in " << secs
+            << "s, retaining " << 100 * retained
+            << "% of the second moment\n";
+}
@@ -0,0 +1,341 @@
+// ctxt_container.cpp - Storing many ciphertexts in one memory-mapped file
+//============================================================================
+// Copyright (c) 2025, Amazon Web Services
+// All rights reserved.
+//
+// This software is licensed under the terms of the Apache License v2.
+// See the file LICENSE.md for details.
+//============================================================================
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <stdexcept>
+
+#include "ctxt_container.h"
+
+using namespace lbcrypto;
+
+static const char CONTAINER_MAGIC[8] = {'F', 'B', 'S', 'C', 'T', 'X', '0', '1'};
+
+// The fixed part of the header, followed by the key tag characters
+struct ContainerHeader {
+  char magic[8];
+  uint64_t n_records;
+  uint64_t index_offset;
+  uint64_t ring_dim;
+  uint64_t key_tag_len;
+};
+
+inline uint64_t align_up(uint64_t x) {
+  return (x + CONTAINER_ALIGNMENT - 1) / CONTAINER_ALIGNMENT
+         * CONTAINER_ALIGNMENT;
+}
+
+/*******************************************************************/
+CtxtContainerWriter::CtxtContainerWriter(const std::filesystem::path& _fname)
+    : fname(_fname), file(_fname, std::ios::out | std::ios::binary) {
+  if (!file.is_open()) {
+    throw std::runtime_error("Cannot open " + fname.string() + " for write");
+  }
+  // Reserve the first page for the header, it is written by close()
+  std::vector<char> zeros(CONTAINER_ALIGNMENT, 0);
+  file.write(zeros.data(), zeros.size());
+}
+
+CtxtContainerWriter::~CtxtContainerWriter() {
+  if (!closed) {
+    try {
+      close();
+    } catch (...) {
+      // Cannot throw from a destructor, the file is left invalid
+    }
+  }
+}
+
+// Append a ciphertext to the container, returns its index
+size_t CtxtContainerWriter::append(const Ciphertext<DCRTPoly>& ct) {
+  ContainerRecordInfo info;
+  info.level = ct->GetLevel();
+  info.noise_scale_deg = ct->GetNoiseScaleDeg();
+  info.slots = ct->GetSlots();
+  info.flags = 0;
+  info.scaling_factor = ct->GetScalingFactor();
+  return append_record(ct->GetElements(), ct->GetKeyTag(), info);
+}
+
+// Append an encoded plaintext to the container, returns its index
+size_t CtxtContainerWriter::append(const Plaintext& pt) {
+  ContainerRecordInfo info;
+  info.level = pt->GetLevel();
+  info.noise_scale_deg = pt->GetNoiseScaleDeg();
+  info.slots = pt->GetSlots();
+  info.flags = CONTAINER_PLAINTEXT;
+  info.scaling_factor = pt->GetScalingFactor();
+  return append_record({pt->GetElement<DCRTPoly>()}, "", info);
+}
+
+// Append a seeded ciphertext: only the component b, followed by the seed
+size_t CtxtContainerWriter::append_seeded(const Ciphertext<DCRTPoly>& ct,
+                                          const PrgSeed& seed) {
+  ContainerRecordInfo info;
+  info.level = ct->GetLevel();
+  info.noise_scale_deg = ct->GetNoiseScaleDeg();
+  info.slots = ct->GetSlots();
+  info.flags = CONTAINER_SEEDED;
+  info.scaling_factor = ct->GetScalingFactor();
+  return append_record({ct->GetElements().at(0)}, ct->GetKeyTag(), info,
+                       &seed);
+}
+
+// Write the towers of a record (and the seed, if any) and add it to the
+// index. The caller sets all the fields of info except offset,
+// n_components, and n_towers.
+size_t CtxtContainerWriter::append_record(const std::vector<DCRTPoly>& elems,
+                                          const std::string& tag,
+                                          ContainerRecordInfo info,
+                                          const PrgSeed* seed) {
+  if (closed) {
+    throw std::logic_error("append to a closed container " + fname.string());
+  }
+  if (elems.empty() || elems[0].GetNumOfElements() == 0) {
+    throw std::invalid_argument("cannot store an empty record");
+  }
+  if (index.empty()) {  // the first record sets the ring dim and key tag
+    ring_dim = elems[0].GetRingDimension();
+    key_tag = tag;
+    if (sizeof(ContainerHeader) + key_tag.size() > CONTAINER_ALIGNMENT) {
+      throw std::invalid_argument("key tag too long: " + key_tag);
+    }
+  } else if (elems[0].GetRingDimension() != ring_dim || tag != key_tag) {
+    throw std::invalid_argument("all records in " + fname.string() +
+                                " must be under the same key and ring");
+  }
+
+  info.offset = align_up(end_offset);
+  info.n_components = elems.size();
+  info.n_towers = elems[0].GetNumOfElements();
+
+  // Pad to the start of the record, then write the towers one at a time
+  std::vector<char> zeros(info.offset - end_offset, 0);
+  file.write(zeros.data(), zeros.size());
+  std::vector<uint64_t> buf(ring_dim);
+  for (const auto& poly : elems) {
+    if (poly.GetFormat() != Format::EVALUATION ||
+        poly.GetNumOfElements() != info.n_towers) {
+      throw std::invalid_argument("malformed record for " + fname.string());
+    }
+    for (uint32_t t = 0; t < info.n_towers; t++) {
+      const auto& values = poly.GetElementAtIndex(t).GetValues();
+      for (uint64_t k = 0; k < ring_dim; k++) {
+        buf[k] = values[k].ConvertToInt<uint64_t>();
+      }
+      file.write(reinterpret_cast<const char*>(buf.data()),
+                 ring_dim * sizeof(uint64_t));
+    }
+  }
+  if (seed != nullptr) {
+    file.write(reinterpret_cast<const char*>(seed->data()), sizeof(PrgSeed));
+  }
+  if (!file) {
+    throw std::runtime_error("failed to write to " + fname.string());
+  }
+  end_offset = info.offset
+      + uint64_t(info.n_components) * info.n_towers * ring_dim
+        * sizeof(uint64_t)
+      + ((seed != nullptr) ? sizeof(PrgSeed) : 0);
+  index.push_back(info);
+  return index.size() - 1;
+}
+
+// Write the index and header and close the file
+void CtxtContainerWriter::close() {
+  if (closed) {
+    return;
+  }
+  closed = true;
+  // The ring dim and key tag come from the first record, and a reader
+  // could not check them against its context without one
+  if (index.empty()) {
+    file.close();
+    throw std::logic_error("cannot close an empty container " +
+                           fname.string());
+  }
+
+  // The index goes after the last record
+  file.write(reinterpret_cast<const char*>(index.data()),
+             index.size() * sizeof(ContainerRecordInfo));
+
+  ContainerHeader header;
+  std::memcpy(header.magic, CONTAINER_MAGIC, sizeof(header.magic));
+  header.n_records = index.size();
+  header.index_offset = end_offset;
+  header.ring_dim = ring_dim;
+  header.key_tag_len = key_tag.size();
+  file.seekp(0);
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(key_tag.data(), key_tag.size());
+  file.close();
+  if (!file) {
+    throw std::runtime_error("failed to write to " + fname.string());
+  }
+}
+
+/*******************************************************************/
+CtxtContainerReader::CtxtContainerReader(const CryptoContext<DCRTPoly>& _cc,
+                                         const std::filesystem::path& _fname)
+    : cc(_cc), fname(_fname) {
+  int fd = open(fname.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("Cannot open " + fname.string() + " for read");
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || size_t(st.st_size) < CONTAINER_ALIGNMENT) {
+    ::close(fd);
+    throw std::runtime_error(fname.string() + " is not a container file");
+  }
+  file_size = st.st_size;
+  void* addr = mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);  // the mapping stays valid after closing the descriptor
+  if (addr == MAP_FAILED) {
+    throw std::runtime_error("Cannot map " + fname.string());
+  }
+  base = static_cast<const uint8_t*>(addr);
+  // The ciphertexts are usually consumed in order
+  madvise(addr, file_size, MADV_SEQUENTIAL);
+
+  // Read and validate the header and index
+  ContainerHeader header;
+  std::memcpy(&header, base, sizeof(header));
+  if (std::memcmp(header.magic, CONTAINER_MAGIC, sizeof(header.magic)) != 0 ||
+      sizeof(header) + header.key_tag_len > CONTAINER_ALIGNMENT ||
+      header.index_offset > file_size ||
+      header.n_records >
+          (file_size - header.index_offset) / sizeof(ContainerRecordInfo)) {
+    munmap(addr, file_size);
+    throw std::runtime_error(fname.string() + " is not a container file");
+  }
+  ring_dim = header.ring_dim;
+  key_tag.assign(reinterpret_cast<const char*>(base + sizeof(header)),
+                 header.key_tag_len);
+  index.resize(header.n_records);
+  std::memcpy(index.data(), base + header.index_offset,
+              index.size() * sizeof(ContainerRecordInfo));
+
+  // Prepare the element parameters for all the records, by dropping the
+  // last moduli of the context parameters as needed
+  auto full_params = cc->GetElementParams();
+  uint32_t max_towers = full_params->GetParams().size();
+  if (ring_dim != cc->GetRingDimension()) {
+    munmap(addr, file_size);
+    throw std::runtime_error(fname.string() + " has the wrong ring dimension");
+  }
+  for (size_t i = 0; i < index.size(); i++) {
+    const auto& info = index[i];
+    if (info.n_towers == 0 || info.n_towers > max_towers ||
+        info.offset % CONTAINER_ALIGNMENT != 0 ||
+        info.offset + record_bytes(i) > header.index_offset) {
+      munmap(addr, file_size);
+      throw std::runtime_error(fname.string() + ": bad record " +
+                               std::to_string(i));
+    }
+    if (params.find(info.n_towers) == params.end()) {
+      auto p = std::make_shared<DCRTPoly::Params>(*full_params);
+      for (uint32_t t = max_towers; t > info.n_towers; t--) {
+        p->PopLastParam();
+      }
+      params[info.n_towers] = p;
+    }
+  }
+}
+
+CtxtContainerReader::~CtxtContainerReader() {
+  if (base != nullptr) {
+    munmap(const_cast<uint8_t*>(base), file_size);
+  }
+}
+
+uint64_t CtxtContainerReader::record_bytes(size_t idx) const {
+  const auto& info = index.at(idx);
+  return uint64_t(info.n_components) * info.n_towers * ring_dim
+         * sizeof(uint64_t)
+         + (is_seeded(idx) ? sizeof(PrgSeed) : 0);
+}
+
+// Read the whole file into the page cache. MADV_SEQUENTIAL (set in the
+// constructor) lets the kernel drop pages soon after they are read, so we
+// switch it off.
+void CtxtContainerReader::keep_resident() const {
+  void* addr = const_cast<uint8_t*>(base);
+  madvise(addr, file_size, MADV_NORMAL);
+  madvise(addr, file_size, MADV_WILLNEED);
+}
+
+// Build the DCRT polynomials of record #idx from the tower data in the file
+std::vector<DCRTPoly> CtxtContainerReader::read_elements(size_t idx) const {
+  const auto& info = index.at(idx);
+  const auto& elem_params = params.at(info.n_towers);
+  const auto& tower_params = elem_params->GetParams();
+  auto data = reinterpret_cast<const uint64_t*>(base + info.offset);
+
+  std::vector<DCRTPoly> elems;
+  elems.reserve(info.n_components);
+  for (uint32_t c = 0; c < info.n_components; c++) {
+    DCRTPoly poly(elem_params, Format::EVALUATION);
+    for (uint32_t t = 0; t < info.n_towers; t++) {
+      NativeVector values(ring_dim, tower_params[t]->GetModulus());
+      for (uint64_t k = 0; k < ring_dim; k++) {
+        values[k] = data[k];
+      }
+      data += ring_dim;
+      NativePoly tower(tower_params[t], Format::EVALUATION);
+      tower.SetValues(std::move(values), Format::EVALUATION);
+      poly.SetElementAtIndex(t, std::move(tower));
+    }
+    elems.push_back(std::move(poly));
+  }
+  return elems;
+}
+
+// Build ciphertext #idx from the tower data in the file
+Ciphertext<DCRTPoly> CtxtContainerReader::get(size_t idx) const {
+  if (is_plaintext(idx)) {
+    throw std::invalid_argument(fname.string() + ": record " +
+                                std::to_string(idx) + " is a plaintext");
+  }
+  const auto& info = index.at(idx);
+  auto ct = std::make_shared<CiphertextImpl<DCRTPoly>>(cc, key_tag,
+                                                       CKKS_PACKED_ENCODING);
+  auto elems = read_elements(idx);
+  if (is_seeded(idx)) {  // the seed comes right after the towers of b
+    PrgSeed seed;
+    std::memcpy(seed.data(), base + info.offset + record_bytes(idx)
+                                 - sizeof(PrgSeed), sizeof(PrgSeed));
+    elems.push_back(expand_seed(seed, params.at(info.n_towers)));
+  }
+  ct->SetElements(std::move(elems));
+  ct->SetLevel(info.level);
+  ct->SetNoiseScaleDeg(info.noise_scale_deg);
+  ct->SetScalingFactor(info.scaling_factor);
+  ct->SetSlots(info.slots);
+  return ct;
+}
+
+// Build plaintext #idx from the tower data in the file. The plaintext is
+// created empty with the right parameters, then we install the encoded
+// element in it.
+Plaintext CtxtContainerReader::get_plaintext(size_t idx) const {
+  if (!is_plaintext(idx) || index.at(idx).n_components != 1) {
+    throw std::invalid_argument(fname.string() + ": record " +
+                                std::to_string(idx) + " is not a plaintext");
+  }
+  const auto& info = index.at(idx);
+  Plaintext pt = std::make_shared<CKKSPackedEncoding>(
+      params.at(info.n_towers), cc->GetEncodingParams(),
+      std::vector<std::complex<double>>(), info.noise_scale_deg, info.level,
+      info.scaling_factor, info.slots);
+  pt->GetElement<DCRTPoly>() = std::move(read_elements(idx)[0]);
+  return pt;
+}
@@ -0,0 +1,194 @@
+// ivf.cpp - Scanning only the batches near the query (inverted-file mode)
+//============================================================================
+// Copyright (c) 2025, Amazon Web Services
+// All rights reserved.
+//
+// This software is licensed under the terms of the Apache License v2.
+// See the file LICENSE.md for details.
+//============================================================================
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <numeric>
+#include <set>
+#include <stdexcept>
+#include <string>
+
+#include "ivf.h"
+#include "parallel.h"
+#include "utils.h"
+
+namespace fs = std::filesystem;
+
+static void check_dims(const std::vector<std::vector<float>>& centers,
+                       size_t dim) {
+  if (centers.empty()) {
+    throw std::invalid_argument("nearest_centers: no centers");
+  }
+  for (const auto& c : centers) {
+    if (c.size() != dim) {
+      throw std::invalid_argument("nearest_centers: a center of dimension " +
+                                  std::to_string(c.size()) + ", expected " +
+                                  std::to_string(dim));
+    }
+  }
+}
+
+// This is a brute-force scan of all the centers for every record, so it
+// takes n_records*n_centers*dim multiply-adds. The records are handled in
+// blocks, and each block goes over the centers a block at a time, so every
+// block of centers is read once from memory and then used from the cache
+// by all the records in the block.
+std::vector<uint32_t> nearest_centers(
+    const float* records, size_t n_records, size_t dim,
+    const std::vector<std::vector<float>>& centers) {
+  check_dims(centers, dim);
+  constexpr size_t RECORD_BLOCK = 64;
+  constexpr size_t CENTER_BLOCK = 256;
+
+  std::vector<uint32_t> best(n_records, 0);
+  int n_blocks = (n_records + RECORD_BLOCK - 1) / RECORD_BLOCK;
+  parallel_for(n_blocks, [&](int b) {
+    size_t r0 = b * RECORD_BLOCK;
+    size_t r1 = std::min(r0 + RECORD_BLOCK, n_records);
+    std::vector<float> best_sim(r1 - r0, -std::numeric_limits<float>::max());
+    for (size_t c0 = 0; c0 < centers.size(); c0 += CENTER_BLOCK) {
+      size_t c1 = std::min(c0 + CENTER_BLOCK, centers.size());
+      for (size_t r = r0; r < r1; r++) {
+        const float* rec = records + r * dim;
+        for (size_t c = c0; c < c1; c++) {
+          float sim = dot_product(rec, centers[c].data(), dim);
+          if (sim > best_sim[r - r0]) {
+            best_sim[r - r0] = sim;
+            best[r] = c;
+          }
+        }
+      }
+    }
+  });
+  return best;
+}
+
+std::vector<uint32_t> nearest_centers(
+    const std::vector<float>& qry,
+    const std::vector<std::vector<float>>& centers, size_t K) {
+  check_dims(centers, qry.size());
+  std::vector<float> sims(centers.size());
+  for (size_t c = 0; c < centers.size(); c++) {
+    sims[c] = dot_product(qry.data(), centers[c].data(), qry.size());
+  }
+  std::vector<uint32_t> idx(centers.size());
+  std::iota(idx.begin(), idx.end(), 0);
+  K = std::min(K, idx.size());
+  std::partial_sort(idx.begin(), idx.begin() + K, idx.end(),
+                    [&sims](uint32_t a, uint32_t b) {
+                      return sims[a] > sims[b];
+                    });
+  idx.resize(K);
+  return idx;
+}
+
+// A counting sort, which is stable
+std::vector<uint32_t> sort_by_center(const std::vector<uint32_t>& assignment,
+                                     size_t n_centers,
+                                     std::vector<uint64_t>& offsets) {
+  offsets.assign(n_centers + 1, 0);
+  for (auto c : assignment) {
+    if (c >= n_centers) {
+      throw std::out_of_range("sort_by_center: no center #" +
+                              std::to_string(c));
+    }
+    offsets[c + 1]++;
+  }
+  for (size_t c = 0; c < n_centers; c++) {
+    offsets[c + 1] += offsets[c];
+  }
+  std::vector<uint64_t> next(offsets.begin(), offsets.end() - 1);
+  std::vector<uint32_t> order(assignment.size());
+  for (size_t r = 0; r < assignment.size(); r++) {
+    order[next[assignment[r]]++] = r;
+  }
+  return order;
+}
+
+template <typename T>
+static void write_array(const fs::path& fname, const std::vector<T>& v) {
+  std::ofstream file(fname, std::ios::binary);
+  file.write(reinterpret_cast<const char*>(v.data()), v.size() * sizeof(T));
+  if (!file) {
+    throw std::runtime_error("failed to write " + fname.string());
+  }
+}
+
+template <typename T>
+static std::vector<T> read_array(const fs::path& fname) {
+  std::ifstream file(fname, std::ios::binary);
+  if (!file.is_open()) {
+    throw std::runtime_error("Cannot open " + fname.string() + " for read");
+  }
+  std::vector<T> v(fs::file_size(fname) / sizeof(T));
+  file.read(reinterpret_cast<char*>(v.data()), v.size() * sizeof(T));
+  if (!file) {
+    throw std::runtime_error("failed to read " + fname.string());
+  }
+  return v;
+}
+
+void write_ivf(const fs::path& dir, const std::vector<uint32_t>& order,
+               const std::vector<uint64_t>& offsets) {
+  write_array(dir / IVF_ORDER_FILE, order);
+  write_array(dir / IVF_LISTS_FILE, offsets);
+}
+
+std::vector<uint32_t> read_ivf_order(const fs::path& dir) {
+  return read_array<uint32_t>(dir / IVF_ORDER_FILE);
+}
+
+std::vector<uint64_t> read_ivf_lists(const fs::path& dir) {
+  auto offsets = read_array<uint64_t>(dir / IVF_LISTS_FILE);
+  if (offsets.size() < 2 || !std::is_sorted(offsets.begin(), offsets.end())) {
+    throw std::runtime_error((dir / IVF_LISTS_FILE).string() +
+                             " is not a list of offsets");
+  }
+  return offsets;
+}
+
+std::vector<int> batches_of_lists(const std::vector<uint32_t>& lists,
+                                  const std::vector<uint64_t>& offsets,
+                                  size_t records_per_batch) {
+  std::set<int> batches;
+  for (auto c : lists) {
+    uint64_t begin = offsets.at(c), end = offsets.at(c + 1);
+    if (begin == end) {  // an empty list
+      continue;
+    }
+    for (uint64_t b = begin / records_per_batch;
+         b <= (end - 1) / records_per_batch; b++) {
+      batches.insert(b);
+    }
+  }
+  return std::vector<int>(batches.begin(), batches.end());
+}
+
+fs::path probe_file(const fs::path& query) {
+  std::string name = query.filename().string();
+  if (name.rfind("query", 0) == 0) {
+    name.replace(0, 5, "probe");
+  } else {
+    name = "probe_" + name;
+  }
+  return query.parent_path() / name;
+}
+
+void write_probe(const fs::path& fname, const std::vector<int>& batches) {
+  std::vector<int32_t> v(batches.begin(), batches.end());
+  write_array(fname, v);
+}
+
+std::optional<std::vector<int>> read_probe(const fs::path& fname) {
+  if (!fs::exists(fname)) {
+    return std::nullopt;
+  }
+  auto v = read_array<int32_t>(fname);
+  return std::vector<int>(v.begin(), v.end());
+}
@@ -0,0 +1,330 @@
+// mult_accumulator.cpp - Fused multiply-accumulate of ciphertext products
+//============================================================================
+// Copyright (c) 2025, Amazon Web Services
+// All rights reserved.
+//
+// This software is licensed under the terms of the Apache License v2.
+// See the file LICENSE.md for details.
+//============================================================================
+#include <algorithm>
+#ifdef WITH_AVX512
+#include <immintrin.h>
+#endif
+
+#include "mult_accumulator.h"
+
+using namespace lbcrypto;
+
+using u128 = unsigned __int128;
+
+// The kernels below access the coefficients of a tower as a plain array
+static_assert(sizeof(NativeInteger) == sizeof(uint64_t),
+              "NativeInteger is expected to be a single 64-bit word");
+
+static inline uint64_t* coeffs(NativePoly& p) {
+  return reinterpret_cast<uint64_t*>(&p[0]);
+}
+static inline const uint64_t* coeffs(const NativePoly& p) {
+  return reinterpret_cast<const uint64_t*>(&p[0]);
+}
+
+// Barrett reduction of a 128-bit x modulo q < 2^62: The estimate
+// qhat = floor(x*mu / 2^128) is at most 2 less than floor(x/q), so
+// x - qhat*q is less than 3q and two conditional subtractions finish it.
+static inline uint64_t reduce128(u128 x, const MultAccumulator::Modulus& m) {
+  uint64_t x_hi = uint64_t(x >> 64), x_lo = uint64_t(x);
+
+  // The top 128 bits of the 256-bit product x*mu
+  u128 lo_lo = (u128(x_lo) * m.mu_lo) >> 64;
+  u128 hi_lo = u128(x_hi) * m.mu_lo;
+  u128 lo_hi = u128(x_lo) * m.mu_hi;
+  u128 mid = lo_lo + uint64_t(hi_lo) + uint64_t(lo_hi);
+  u128 qhat = u128(x_hi) * m.mu_hi + (hi_lo >> 64) + (lo_hi >> 64)
+              + (mid >> 64);
+
+  uint64_t r = uint64_t(x - qhat * m.q);
+  if (r >= m.q) r -= m.q;
+  if (r >= m.q) r -= m.q;
+  return r;
+}
+
+// Add x to the unreduced 128-bit value hi:lo
+static inline void add128(uint64_t& hi, uint64_t& lo, u128 x) {
+  u128 sum = ((u128(hi) << 64) | lo) + x;
+  hi = uint64_t(sum >> 64);
+  lo = uint64_t(sum);
+}
+
+// The per-tower kernels: add a*b (three components) or a*p (two components)
+// to the unreduced sum whose low and high words are c and h. The scalar
+// ones use radix 2^64.
+static void mac_ctxt_scalar(size_t n, const uint64_t* a0, const uint64_t* a1,
+                            const uint64_t* b0, const uint64_t* b1,
+                            uint64_t* c0, uint64_t* c1, uint64_t* c2,
+                            uint64_t* h0, uint64_t* h1, uint64_t* h2) {
+  for (size_t k = 0; k < n; k++) {
+    add128(h0[k], c0[k], u128(a0[k]) * b0[k]);
+    add128(h1[k], c1[k], u128(a0[k]) * b1[k] + u128(a1[k]) * b0[k]);
+    add128(h2[k], c2[k], u128(a1[k]) * b1[k]);
+  }
+}
+
+static void mac_ptxt_scalar(size_t n, const uint64_t* a0, const uint64_t* a1,
+                            const uint64_t* p0, uint64_t* c0, uint64_t* c1,
+                            uint64_t* h0, uint64_t* h1) {
+  for (size_t k = 0; k < n; k++) {
+    add128(h0[k], c0[k], u128(a0[k]) * p0[k]);
+    add128(h1[k], c1[k], u128(a1[k]) * p0[k]);
+  }
+}
+
+#ifdef WITH_AVX512
+// The IFMA kernels, for moduli below 2^52 and n divisible by 8. They use
+// radix 2^52: the low 52 bits of each product go to c and the high 52 bits
+// to h. These functions are compiled for AVX-512 regardless of the flags
+// of the rest of the build, and only called if the CPU supports it.
+#define IFMA_TARGET __attribute__((target("avx512f,avx512ifma")))
+
+IFMA_TARGET static void mac_ctxt_ifma(
+    size_t n, const uint64_t* a0, const uint64_t* a1, const uint64_t* b0,
+    const uint64_t* b1, uint64_t* c0, uint64_t* c1, uint64_t* c2,
+    uint64_t* h0, uint64_t* h1, uint64_t* h2) {
+  for (size_t k = 0; k < n; k += 8) {
+    __m512i x0 = _mm512_loadu_si512(a0 + k), x1 = _mm512_loadu_si512(a1 + k);
+    __m512i y0 = _mm512_loadu_si512(b0 + k), y1 = _mm512_loadu_si512(b1 + k);
+
+    __m512i lo = _mm512_loadu_si512(c0 + k), hi = _mm512_loadu_si512(h0 + k);
+    _mm512_storeu_si512(c0 + k, _mm512_madd52lo_epu64(lo, x0, y0));
+    _mm512_storeu_si512(h0 + k, _mm512_madd52hi_epu64(hi, x0, y0));
+
+    lo = _mm512_loadu_si512(c1 + k);
+    hi = _mm512_loadu_si512(h1 + k);
+    lo = _mm512_madd52lo_epu64(lo, x0, y1);
+    hi = _mm512_madd52hi_epu64(hi, x0, y1);
+    _mm512_storeu_si512(c1 + k, _mm512_madd52lo_epu64(lo, x1, y0));
+    _mm512_storeu_si512(h1 + k, _mm512_madd52hi_epu64(hi, x1, y0));
+
+    lo = _mm512_loadu_si512(c2 + k);
+    hi = _mm512_loadu_si512(h2 + k);
+    _mm512_storeu_si512(c2 + k, _mm512_madd52lo_epu64(lo, x1, y1));
+    _mm512_storeu_si512(h2 + k, _mm512_madd52hi_epu64(hi, x1, y1));
+  }
+}
+
+IFMA_TARGET static void mac_ptxt_ifma(
+    size_t n, const uint64_t* a0, const uint64_t* a1, const uint64_t* p0,
+    uint64_t* c0, uint64_t* c1, uint64_t* h0, uint64_t* h1) {
+  for (size_t k = 0; k < n; k += 8) {
+    __m512i x0 = _mm512_loadu_si512(a0 + k), x1 = _mm512_loadu_si512(a1 + k);
+    __m512i y = _mm512_loadu_si512(p0 + k);
+
+    __m512i lo = _mm512_loadu_si512(c0 + k), hi = _mm512_loadu_si512(h0 + k);
+    _mm512_storeu_si512(c0 + k, _mm512_madd52lo_epu64(lo, x0, y));
+    _mm512_storeu_si512(h0 + k, _mm512_madd52hi_epu64(hi, x0, y));
+
+    lo = _mm512_loadu_si512(c1 + k);
+    hi = _mm512_loadu_si512(h1 + k);
+    _mm512_storeu_si512(c1 + k, _mm512_madd52lo_epu64(lo, x1, y));
+    _mm512_storeu_si512(h1 + k, _mm512_madd52hi_epu64(hi, x1, y));
+  }
+}
+
+static bool cpu_has_ifma() {
+  static const bool has_ifma = __builtin_cpu_supports("avx512f") &&
+                               __builtin_cpu_supports("avx512ifma");
+  return has_ifma;
+}
+#else
+static bool cpu_has_ifma() { return false; }
+#endif
+
+const char* MultAccumulator::kernel_name() {
+  return cpu_has_ifma() ? "AVX-512 IFMA" : "scalar";
+}
+
+void MultAccumulator::start(const Ciphertext<DCRTPoly>& prod, size_t level,
+                            size_t noise_scale_deg, size_t n_components) {
+  sum = prod;
+  in_level = level;
+  in_noise_scale_deg = noise_scale_deg;
+  sum_scale = prod->GetScalingFactor();
+
+  // The in-place kernels assume fresh inputs (noise-scale degree 1), a
+  // product with the expected number of components, and moduli below 2^62
+  // so that at least a few steps fit in 128 bits between reductions
+  const auto& elems = sum->GetElements();
+  fusable = (noise_scale_deg == 1 && elems.size() == n_components);
+  moduli.clear();
+  max_lazy = ~size_t(0);
+  for (size_t t = 0; fusable && t < elems[0].GetNumOfElements(); t++) {
+    uint64_t q =
+        elems[0].GetElementAtIndex(t).GetModulus().ConvertToInt<uint64_t>();
+    if (q >= (uint64_t(1) << 62)) {
+      fusable = false;
+      break;
+    }
+    size_t n = elems[0].GetElementAtIndex(t).GetLength();
+    int radix_bits =
+        (cpu_has_ifma() && q < (uint64_t(1) << 52) && n % 8 == 0) ? 52 : 64;
+    u128 mu = ~u128(0) / q;
+    moduli.push_back({q, uint64_t(mu >> 64), uint64_t(mu), radix_bits});
+
+    // A reduced coefficient (< q) plus s steps that add at most 2(q-1)^2
+    // each must stay below 2^128. In radix 2^52 the low word is the first
+    // to overflow, as it gets 2 values below 2^52 per step.
+    u128 steps = (radix_bits == 52)
+                     ? (~uint64_t(0) - q) / (uint64_t(2) << 52)
+                     : (~u128(0) - q) / (2 * u128(q) * q);
+    max_lazy = size_t(std::min<u128>(max_lazy, steps));
+  }
+  ring_dim = fusable ? elems[0].GetElementAtIndex(0).GetLength() : 0;
+  n_lazy = 0;
+}
+
+bool MultAccumulator::matches(size_t level, size_t noise_scale_deg,
+                              double scale, size_t n_towers) const {
+  return fusable && level == in_level &&
+         noise_scale_deg == in_noise_scale_deg && scale == sum_scale &&
+         n_towers == moduli.size();
+}
+
+void MultAccumulator::reserve_step() {
+  if (hi.empty()) {
+    hi.assign(sum->GetElements().size() * moduli.size() * ring_dim, 0);
+  } else if (n_lazy >= max_lazy) {
+    reduce();
+  }
+  n_lazy++;
+}
+
+void MultAccumulator::reduce() {
+  if (n_lazy == 0) {
+    return;
+  }
+  auto& acc = sum->GetElements();
+  int n_towers = moduli.size();
+  int n_polys = acc.size() * n_towers;
+#pragma omp parallel for
+  for (int i = 0; i < n_polys; i++) {  // i = component*n_towers + tower
+    int t = i % n_towers;
+    uint64_t* lo = coeffs(acc[i / n_towers].GetAllElements()[t]);
+    uint64_t* h = &hi[i * ring_dim];
+    int radix_bits = moduli[t].radix_bits;
+    for (size_t k = 0; k < ring_dim; k++) {
+      lo[k] = reduce128((u128(h[k]) << radix_bits) + lo[k], moduli[t]);
+      h[k] = 0;
+    }
+  }
+  n_lazy = 0;
+}
+
+void MultAccumulator::add_unfused(const Ciphertext<DCRTPoly>& prod) {
+  reduce();
+  // The addition may adjust the level, number of towers or scale of the
+  // sum, after which none of the state above describes it anymore
+  fusable = false;
+  moduli.clear();
+  std::vector<uint64_t>().swap(hi);
+  sum->GetCryptoContext()->EvalAddInPlace(sum, prod);
+}
+
+Ciphertext<DCRTPoly> MultAccumulator::get() {
+  if (sum != nullptr) {
+    reduce();
+    std::vector<uint64_t>().swap(hi);
+  }
+  return sum;
+}
+
+void MultAccumulator::add_product(const Ciphertext<DCRTPoly>& a,
+                                  const Ciphertext<DCRTPoly>& b) {
+  auto cc = a->GetCryptoContext();
+  if (sum == nullptr) {
+    auto prod = cc->EvalMultNoRelin(a, b);
+    start(prod, a->GetLevel(), a->GetNoiseScaleDeg(), 3);
+    fusable = fusable && b->GetLevel() == a->GetLevel() &&
+              b->GetNoiseScaleDeg() == a->GetNoiseScaleDeg() &&
+              a->GetElements().size() == 2 && b->GetElements().size() == 2;
+    return;
+  }
+  const auto& ea = a->GetElements();
+  const auto& eb = b->GetElements();
+  if (a->GetLevel() != b->GetLevel() || ea.size() != 2 || eb.size() != 2 ||
+      !matches(a->GetLevel(), a->GetNoiseScaleDeg(),
+               a->GetScalingFactor() * b->GetScalingFactor(),
+               ea[0].GetNumOfElements()) ||
+      b->GetNoiseScaleDeg() != in_noise_scale_deg) {
+    add_unfused(cc->EvalMultNoRelin(a, b));
+    return;
+  }
+  reserve_step();
+
+  auto& acc = sum->GetElements();
+  int n_towers = moduli.size();
+#pragma omp parallel for
+  for (int t = 0; t < n_towers; t++) {
+    const uint64_t* a0 = coeffs(ea[0].GetElementAtIndex(t));
+    const uint64_t* a1 = coeffs(ea[1].GetElementAtIndex(t));
+    const uint64_t* b0 = coeffs(eb[0].GetElementAtIndex(t));
+    const uint64_t* b1 = coeffs(eb[1].GetElementAtIndex(t));
+    uint64_t* c0 = coeffs(acc[0].GetAllElements()[t]);
+    uint64_t* c1 = coeffs(acc[1].GetAllElements()[t]);
+    uint64_t* c2 = coeffs(acc[2].GetAllElements()[t]);
+    uint64_t* h0 = &hi[(0 * n_towers + t) * ring_dim];
+    uint64_t* h1 = &hi[(1 * n_towers + t) * ring_dim];
+    uint64_t* h2 = &hi[(2 * n_towers + t) * ring_dim];
+#ifdef WITH_AVX512
+    if (moduli[t].radix_bits == 52) {
+      mac_ctxt_ifma(ring_dim, a0, a1, b0, b1, c0, c1, c2, h0, h1, h2);
+      continue;
+    }
+#endif
+    mac_ctxt_scalar(ring_dim, a0, a1, b0, b1, c0, c1, c2, h0, h1, h2);
+  }
+}
+
+void MultAccumulator::add_product(const Ciphertext<DCRTPoly>& a,
+                                  const Plaintext& p) {
+  auto cc = a->GetCryptoContext();
+  if (sum == nullptr) {
+    auto prod = cc->EvalMult(a, p);
+    start(prod, a->GetLevel(), a->GetNoiseScaleDeg(), 2);
+    fusable = fusable && p->GetLevel() == a->GetLevel() &&
+              p->GetNoiseScaleDeg() == a->GetNoiseScaleDeg() &&
+              a->GetElements().size() == 2;
+    return;
+  }
+  const auto& ea = a->GetElements();
+  const auto& ep = p->GetElement<DCRTPoly>();
+  if (a->GetLevel() != p->GetLevel() || ea.size() != 2 ||
+      ep.GetFormat() != Format::EVALUATION ||
+      ep.GetNumOfElements() != ea[0].GetNumOfElements() ||
+      !matches(a->GetLevel(), a->GetNoiseScaleDeg(),
+               a->GetScalingFactor() * p->GetScalingFactor(),
+               ea[0].GetNumOfElements()) ||
+      p->GetNoiseScaleDeg() != in_noise_scale_deg) {
+    add_unfused(cc->EvalMult(a, p));
+    return;
+  }
+  reserve_step();
+
+  auto& acc = sum->GetElements();
+  int n_towers = moduli.size();
+#pragma omp parallel for
+  for (int t = 0; t < n_towers; t++) {
+    const uint64_t* a0 = coeffs(ea[0].GetElementAtIndex(t));
+    const uint64_t* a1 = coeffs(ea[1].GetElementAtIndex(t));
+    const uint64_t* p0 = coeffs(ep.GetElementAtIndex(t));
+    uint64_t* c0 = coeffs(acc[0].GetAllElements()[t]);
+    uint64_t* c1 = coeffs(acc[1].GetAllElements()[t]);
+    uint64_t* h0 = &hi[(0 * n_towers + t) * ring_dim];
+    uint64_t* h1 = &hi[(1 * n_towers + t) * ring_dim];
+#ifdef WITH_AVX512
+    if (moduli[t].radix_bits == 52) {
+      mac_ptxt_ifma(ring_dim, a0, a1, p0, c0, c1, h0, h1);
+      continue;
+    }
+#endif
+    mac_ptxt_scalar(ring_dim, a0, a1, p0, c0, c1, h0, h1);
+  }
+}
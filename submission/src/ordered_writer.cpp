@@ -0,0 +1,156 @@
+// ordered_writer.cpp - Writing the results of a parallel loop in order
+//============================================================================
+// Copyright (c) 2025, Amazon Web Services
+// All rights reserved.
+//
+// This software is licensed under the terms of the Apache License v2.
+// See the file LICENSE.md for details.
+//============================================================================
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+#include "ordered_writer.h"
+
+using Clock = std::chrono::steady_clock;
+static double seconds_since(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+OrderedWriter::OrderedWriter(size_t _n_items, size_t _depth)
+    : n_items(_n_items), depth(std::max<size_t>(_depth, 1)) {
+  writer = std::thread(&OrderedWriter::writer_loop, this);
+}
+
+OrderedWriter::~OrderedWriter() {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    stopping = true;
+  }
+  ready_cv.notify_all();
+  space_cv.notify_all();
+  if (writer.joinable()) {
+    writer.join();
+  }
+}
+
+// The main loop of the writer thread: wait for the next job in order, run
+// it, and make room for one more in the queue
+void OrderedWriter::writer_loop() {
+  while (true) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      if (stopping || next_to_write >= n_items) {
+        return;
+      }
+      auto it = ready.find(next_to_write);
+      if (it == ready.end()) {  // not there yet, wait
+        auto start = Clock::now();
+        ready_cv.wait(lock, [this, &it] {
+          it = ready.find(next_to_write);
+          return stopping || it != ready.end();
+        });
+        stats.n_writer_stalls++;
+        stats.writer_stall_secs += seconds_since(start);
+        if (stopping) {
+          return;
+        }
+      }
+      job = std::move(it->second);
+      ready.erase(it);
+    }
+
+    try {
+      job();
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mtx);
+      if (error == nullptr) {
+        error = std::current_exception();
+      }
+      stopping = true;
+      space_cv.notify_all();
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      next_to_write++;
+      stats.n_written++;
+    }
+    space_cv.notify_all();
+  }
+}
+
+// Hand over job #idx, waiting while it is too far ahead of the writer
+void OrderedWriter::put(size_t idx, Job job) {
+  if (idx >= n_items) {
+    throw std::out_of_range("OrderedWriter::put: no item #" +
+                            std::to_string(idx));
+  }
+  {
+    std::unique_lock<std::mutex> lock(mtx);
+    if (!stopping && idx >= next_to_write + depth) {
+      auto start = Clock::now();  // the queue is full, wait for space
+      space_cv.wait(lock, [this, idx] {
+        return stopping || idx < next_to_write + depth;
+      });
+      stats.n_producer_stalls++;
+      stats.producer_stall_secs += seconds_since(start);
+    }
+    if (error != nullptr) {
+      std::rethrow_exception(error);
+    }
+    depth_sum += ready.size();  // sample the queue depth
+    n_put++;
+    ready[idx] = std::move(job);
+  }
+  ready_cv.notify_one();
+}
+
+void OrderedWriter::fail(std::exception_ptr e) {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (error == nullptr) {
+      error = e;
+    }
+    stopping = true;
+  }
+  ready_cv.notify_all();
+  space_cv.notify_all();
+}
+
+void OrderedWriter::finish() {
+  if (writer.joinable()) {
+    writer.join();
+  }
+  std::lock_guard<std::mutex> lock(mtx);
+  if (error != nullptr) {
+    std::rethrow_exception(error);
+  }
+}
+
+OrderedWriter::Stats OrderedWriter::get_stats() const {
+  std::lock_guard<std::mutex> lock(mtx);
+  Stats result = stats;
+  if (n_put > 0) {
+    result.avg_depth = double(depth_sum) / n_put;
+  }
+  return result;
+}
+
+// Report the statistics. If the producers spent more time waiting than the
+// writer then we are write bound, otherwise we are compute bound.
+std::string OrderedWriter::report() const {
+  auto s = get_stats();
+  std::stringstream ss;
+  ss << std::fixed << std::setprecision(1) << "writer queue depth "
+     << s.avg_depth << " of " << depth << " on average, producers stalled "
+     << s.n_producer_stalls << " times (" << s.producer_stall_secs
+     << "s), writer stalled " << s.n_writer_stalls << " of " << s.n_written
+     << " times (" << s.writer_stall_secs << "s): "
+     << ((s.producer_stall_secs > s.writer_stall_secs) ? "write bound"
+                                                       : "compute bound");
+  return ss.str();
+}
@@ -0,0 +1,156 @@
+// prefetch.cpp - Loading dataset ciphertexts ahead of the computation
+//============================================================================
+// Copyright (c) 2025, Amazon Web Services
+// All rights reserved.
+//
+// This software is licensed under the terms of the Apache License v2.
+// See the file LICENSE.md for details.
+//============================================================================
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+
+#include "prefetch.h"
+
+using namespace lbcrypto;
+
+using Clock = std::chrono::steady_clock;
+static double seconds_since(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+template <typename T>
+Prefetcher<T>::Prefetcher(size_t _n_items, Loader _load, size_t _depth,
+                          int n_readers)
+    : n_items(_n_items), depth(std::max<size_t>(_depth, 1)), load(_load) {
+  if (n_readers < 1) {
+    n_readers = 1;
+  }
+  readers.reserve(n_readers);
+  for (int i = 0; i < n_readers; i++) {
+    readers.emplace_back(&Prefetcher::reader_loop, this);
+  }
+}
+
+template <typename T>
+Prefetcher<T>::~Prefetcher() {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    stopping = true;
+  }
+  space_cv.notify_all();
+  for (auto& t : readers) {
+    t.join();
+  }
+}
+
+// The main loop of the reader threads: reserve a place in the queue, then
+// take the next index and load the corresponding ciphertext. Reserving
+// before taking the index ensures that every index that was handed to a
+// reader will be loaded, even when the queue is full.
+template <typename T>
+void Prefetcher<T>::reader_loop() {
+  while (true) {
+    size_t idx;
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      if (!stopping && next_to_load < n_items && in_flight >= depth) {
+        auto start = Clock::now();  // the queue is full, wait for space
+        space_cv.wait(lock, [this] {
+          return stopping || next_to_load >= n_items || in_flight < depth;
+        });
+        stats.n_reader_stalls++;
+        stats.reader_stall_secs += seconds_since(start);
+      }
+      if (stopping || next_to_load >= n_items) {
+        return;
+      }
+      idx = next_to_load++;
+      in_flight++;
+    }
+
+    T item;
+    try {
+      item = load(idx);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mtx);
+      if (error == nullptr) {
+        error = std::current_exception();
+      }
+      stopping = true;
+      ready_cv.notify_all();
+      space_cv.notify_all();
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      ready[idx] = item;
+    }
+    ready_cv.notify_all();
+  }
+}
+
+// Wait for item #idx to be loaded and hand it over to the caller
+template <typename T>
+T Prefetcher<T>::get(size_t idx) {
+  if (idx >= n_items) {
+    throw std::out_of_range("Prefetcher::get: no item #" +
+                            std::to_string(idx));
+  }
+  T item;
+  {
+    std::unique_lock<std::mutex> lock(mtx);
+    depth_sum += ready.size();  // sample the queue depth
+    stats.n_taken++;
+
+    auto it = ready.find(idx);
+    if (it == ready.end() && error == nullptr) {  // not there yet, wait
+      auto start = Clock::now();
+      ready_cv.wait(lock, [this, idx, &it] {
+        it = ready.find(idx);
+        return it != ready.end() || error != nullptr;
+      });
+      stats.n_consumer_stalls++;
+      stats.consumer_stall_secs += seconds_since(start);
+    }
+    if (it == ready.end()) {
+      std::rethrow_exception(error);
+    }
+    item = it->second;
+    ready.erase(it);
+    in_flight--;
+  }
+  space_cv.notify_one();
+  return item;
+}
+
+template <typename T>
+typename Prefetcher<T>::Stats Prefetcher<T>::get_stats() const {
+  std::lock_guard<std::mutex> lock(mtx);
+  Stats result = stats;
+  if (result.n_taken > 0) {
+    result.avg_depth = double(depth_sum) / result.n_taken;
+  }
+  return result;
+}
+
+// Report the statistics. If the consumers spent more time waiting than the
+// readers then we are I/O bound, otherwise we are compute bound.
+template <typename T>
+std::string Prefetcher<T>::report() const {
+  auto s = get_stats();
+  std::stringstream ss;
+  ss << std::fixed << std::setprecision(1) << "prefetch queue depth "
+     << s.avg_depth << " of " << depth << " on average, consumers stalled "
+     << s.n_consumer_stalls << " of " << s.n_taken << " times ("
+     << s.consumer_stall_secs << "s), readers stalled " << s.n_reader_stalls
+     << " times (" << s.reader_stall_secs << "s): "
+     << ((s.consumer_stall_secs > s.reader_stall_secs) ? "I/O bound"
+                                                       : "compute bound");
+  return ss.str();
+}
+
+// The types used by the server
+template class Prefetcher<Ciphertext<DCRTPoly>>;
+template class Prefetcher<Plaintext>;
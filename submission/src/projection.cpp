@@ -0,0 +1,212 @@
+// projection.cpp - Reducing the dimension of the records and queries
+//============================================================================
+// Copyright (c) 2025, Amazon Web Services
+// All rights reserved.
+//
+// This software is licensed under the terms of the Apache License v2.
+// See the file LICENSE.md for details.
+//============================================================================
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+
+#include "projection.h"
+#include "parallel.h"
+
+Projection::Projection(size_t _in_dim, size_t _out_dim,
+                       std::vector<float> _matrix)
+    : in_dim(_in_dim), out_dim(_out_dim), matrix(std::move(_matrix)) {
+  if (out_dim == 0 || out_dim > in_dim || matrix.size() != in_dim * out_dim) {
+    throw std::invalid_argument("Projection: a " +
+                                std::to_string(matrix.size()) +
+                                "-entry matrix cannot map dimension " +
+                                std::to_string(in_dim) + " to " +
+                                std::to_string(out_dim));
+  }
+}
+
+// The second-moment matrix of a sample of the records, then its top
+// eigenvectors. Every thread sums the outer products of its own share of
+// the sample (upper triangle only), and the partial sums are added up.
+Projection Projection::fit(RecordReader<float>& db, size_t in_dim,
+                           size_t out_dim, size_t max_samples,
+                           double* retained) {
+  size_t stride = std::max<size_t>(1, (db.size() + max_samples - 1)
+                                          / max_samples);
+  std::vector<uint32_t> idx;
+  for (size_t i = 0; i < db.size(); i += stride) {
+    idx.push_back(i);
+  }
+  if (idx.empty()) {
+    throw std::invalid_argument("Projection::fit: no records");
+  }
+  std::vector<float> sample;
+  db.read(sample, idx.data(), idx.size());
+
+  int n_parts = get_num_threads();
+  std::vector<std::vector<double>> partial(n_parts);
+  parallel_for(n_parts, [&](int p) {
+    auto& m = partial[p];
+    m.assign(in_dim * in_dim, 0.0);
+    for (size_t r = p; r < idx.size(); r += n_parts) {
+      const float* x = &sample[r * in_dim];
+      for (size_t i = 0; i < in_dim; i++) {
+        double xi = x[i];
+        double* row = &m[i * in_dim];
+        for (size_t j = i; j < in_dim; j++) {
+          row[j] += xi * x[j];
+        }
+      }
+    }
+  });
+  std::vector<double> moment(in_dim * in_dim, 0.0);
+  for (size_t i = 0; i < in_dim; i++) {
+    for (size_t j = i; j < in_dim; j++) {
+      double sum = 0;
+      for (const auto& m : partial) {
+        sum += m[i * in_dim + j];
+      }
+      moment[i * in_dim + j] = moment[j * in_dim + i] = sum / idx.size();
+    }
+  }
+
+  std::vector<std::vector<double>> vecs;
+  auto vals = symmetric_eigen(std::move(moment), in_dim, vecs);
+  std::vector<float> matrix;
+  matrix.reserve(in_dim * out_dim);
+  for (size_t k = 0; k < out_dim; k++) {
+    matrix.insert(matrix.end(), vecs[k].begin(), vecs[k].end());
+  }
+  if (retained != nullptr) {
+    double total = std::accumulate(vals.begin(), vals.end(), 0.0);
+    double top = std::accumulate(vals.begin(), vals.begin() + out_dim, 0.0);
+    *retained = (total > 0) ? top / total : 1.0;
+  }
+  return Projection(in_dim, out_dim, std::move(matrix));
+}
+
+Projection Projection::read(const std::filesystem::path& fname,
+                            size_t in_dim, size_t out_dim) {
+  std::ifstream file(fname, std::ios::binary);
+  if (!file.is_open()) {
+    throw std::runtime_error("Cannot open " + fname.string() + " for read");
+  }
+  if (std::filesystem::file_size(fname) != in_dim * out_dim * sizeof(float)) {
+    throw std::runtime_error(fname.string() + " does not project dimension " +
+                             std::to_string(in_dim) + " to " +
+                             std::to_string(out_dim));
+  }
+  std::vector<float> matrix(in_dim * out_dim);
+  file.read(reinterpret_cast<char*>(matrix.data()),
+            matrix.size() * sizeof(float));
+  return Projection(in_dim, out_dim, std::move(matrix));
+}
+
+void Projection::write(const std::filesystem::path& fname) const {
+  std::ofstream file(fname, std::ios::binary);
+  file.write(reinterpret_cast<const char*>(matrix.data()),
+             matrix.size() * sizeof(float));
+  if (!file) {
+    throw std::runtime_error("failed to write " + fname.string());
+  }
+}
+
+void Projection::apply(const float* in, size_t n,
+                       std::vector<float>& out) const {
+  out.resize(n * out_dim);
+  constexpr int BLOCK = 256;  // records per parallel_for iteration
+  parallel_for((n + BLOCK - 1) / BLOCK, [&](int b) {
+    for (size_t r = b * BLOCK; r < std::min(n, size_t(b + 1) * BLOCK); r++) {
+      float* y = &out[r * out_dim];
+      double norm2 = 0;
+      for (size_t k = 0; k < out_dim; k++) {
+        y[k] = dot_product(in + r * in_dim, &matrix[k * in_dim], in_dim);
+        norm2 += double(y[k]) * y[k];
+      }
+      if (norm2 > 0) {
+        float inv = 1.0 / std::sqrt(norm2);
+        for (size_t k = 0; k < out_dim; k++) {
+          y[k] *= inv;
+        }
+      }
+    }
+  });
+}
+
+std::vector<float> Projection::apply(const std::vector<float>& v) const {
+  if (v.size() != in_dim) {
+    throw std::invalid_argument("Projection::apply: a vector of dimension " +
+                                std::to_string(v.size()) + ", expected " +
+                                std::to_string(in_dim));
+  }
+  std::vector<float> out;
+  apply(v.data(), 1, out);
+  return out;
+}
+
+// The cyclic Jacobi method: every rotation zeros one off-diagonal entry
+// (p,q), and sweeps over all the pairs are repeated until the off-diagonal
+// mass is negligible. The rotations are accumulated in the rows of w, so
+// w ends up holding the eigenvectors.
+std::vector<double> symmetric_eigen(std::vector<double> a, size_t n,
+                                    std::vector<std::vector<double>>& vecs) {
+  if (a.size() != n * n) {
+    throw std::invalid_argument("symmetric_eigen: not an n-by-n matrix");
+  }
+  std::vector<double> w(n * n, 0.0);
+  for (size_t i = 0; i < n; i++) {
+    w[i * n + i] = 1.0;
+  }
+  auto rotate = [](double* x, double* y, size_t len, size_t step,
+                   double c, double s) {
+    for (size_t k = 0; k < len; k++) {
+      double xk = x[k * step], yk = y[k * step];
+      x[k * step] = c * xk - s * yk;
+      y[k * step] = s * xk + c * yk;
+    }
+  };
+
+  for (int sweep = 0; sweep < 100; sweep++) {
+    double off = 0, diag = 0;
+    for (size_t i = 0; i < n; i++) {
+      diag += a[i * n + i] * a[i * n + i];
+      for (size_t j = i + 1; j < n; j++) {
+        off += a[i * n + j] * a[i * n + j];
+      }
+    }
+    if (off <= 1e-24 * diag) {
+      break;
+    }
+    for (size_t p = 0; p < n; p++) {
+      for (size_t q = p + 1; q < n; q++) {
+        double apq = a[p * n + q];
+        if (std::abs(apq) < 1e-300) {
+          continue;
+        }
+        double theta = (a[q * n + q] - a[p * n + p]) / (2 * apq);
+        double t = ((theta >= 0) ? 1.0 : -1.0)
+                   / (std::abs(theta) + std::sqrt(theta * theta + 1));
+        double c = 1 / std::sqrt(t * t + 1), s = t * c;
+        rotate(&a[p], &a[q], n, n, c, s);          // columns p,q
+        rotate(&a[p * n], &a[q * n], n, 1, c, s);  // rows p,q
+        rotate(&w[p * n], &w[q * n], n, 1, c, s);
+      }
+    }
+  }
+
+  std::vector<size_t> order(n);
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&a, n](size_t i, size_t j) {
+    return a[i * n + i] > a[j * n + j];
+  });
+  std::vector<double> vals;
+  vecs.clear();
+  for (auto i : order) {
+    vals.push_back(a[i * n + i]);
+    vecs.emplace_back(w.begin() + i * n, w.begin() + (i + 1) * n);
+  }
+  return vals;
+}
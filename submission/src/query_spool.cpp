@@ -0,0 +1,196 @@
+// query_spool.cpp - Handing queries over to a long-running server process
+//============================================================================
+// Copyright (c) 2025, Amazon Web Services
+// All rights reserved.
+//
+// This software is licensed under the terms of the Apache License v2.
+// See the file LICENSE.md for details.
+//============================================================================
+#include <signal.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include "query_spool.h"
+
+namespace fs = std::filesystem;
+
+// How often the client and daemon look at the spool directory
+constexpr auto POLL_INTERVAL = std::chrono::milliseconds(5);
+
+// Write the file under a temporary name, then rename it into place
+static void write_atomically(const fs::path& fname, const std::string& data) {
+  auto tmp = fname;
+  tmp += ".tmp";
+  {
+    std::ofstream file(tmp, std::ios::out | std::ios::trunc);
+    if (!file.is_open() || !(file << data) || (file.close(), !file)) {
+      throw std::runtime_error("Cannot write " + tmp.string());
+    }
+  }
+  fs::rename(tmp, fname);
+}
+
+static fs::path with_suffix(const fs::path& dir, const std::string& id,
+                            const char* suffix) {
+  return dir / (id + suffix);
+}
+
+QuerySpool::QuerySpool(const fs::path& _dir) : dir(_dir) {}
+
+// The pid of the daemon serving this spool, or 0 if there is none
+pid_t QuerySpool::daemon_pid() const {
+  std::ifstream file(pid_file());
+  pid_t pid = 0;
+  if (!file.is_open() || !(file >> pid) || pid <= 0) {
+    return 0;
+  }
+  // Signal 0 only checks that the process exists
+  if (kill(pid, 0) != 0 && errno != EPERM) {
+    return 0;  // a stale pid file, left by a daemon that crashed
+  }
+  return pid;
+}
+
+/*******************************************************************/
+// Hand a request to the daemon, returns the request id
+std::string QuerySpool::submit(const fs::path& query, const fs::path& result,
+                               const std::string& layout, bool count_only,
+                               bool top_k) {
+  auto now = std::chrono::system_clock::now().time_since_epoch();
+  std::stringstream id;
+  id << std::setw(20) << std::setfill('0')
+     << std::chrono::duration_cast<std::chrono::nanoseconds>(now).count()
+     << '_' << getpid();
+
+  std::stringstream req;
+  req << "query " << fs::absolute(query).string() << '\n'
+      << "result " << fs::absolute(result).string() << '\n'
+      << "layout " << layout << '\n'
+      << "count_only " << (count_only ? 1 : 0) << '\n'
+      << "top_k " << (top_k ? 1 : 0) << '\n';
+  write_atomically(with_suffix(dir, id.str(), ".req"), req.str());
+  return id.str();
+}
+
+// Wait for a request to be answered
+bool QuerySpool::wait(const std::string& id) {
+  auto done = with_suffix(dir, id, ".done");
+  while (true) {
+    if (!fs::exists(done) && daemon_pid() == 0) {
+      // The daemon is gone. Withdraw the request unless it was answered
+      // just before the daemon exited.
+      fs::remove(with_suffix(dir, id, ".req"));
+      fs::remove(with_suffix(dir, id, ".work"));
+      if (!fs::exists(done)) {
+        return false;
+      }
+    }
+    if (fs::exists(done)) {
+      std::string outcome;
+      {
+        std::ifstream file(done);
+        std::getline(file, outcome);
+      }
+      fs::remove(done);
+      if (outcome != "ok") {
+        throw std::runtime_error("server daemon failed: " + outcome);
+      }
+      return true;
+    }
+    std::this_thread::sleep_for(POLL_INTERVAL);
+  }
+}
+
+/*******************************************************************/
+// Announce this process as the daemon serving the spool
+void QuerySpool::start_serving() {
+  fs::create_directories(dir);
+  auto pid = daemon_pid();
+  if (pid != 0 && pid != getpid()) {
+    throw std::runtime_error("a server daemon (pid " + std::to_string(pid) +
+                             ") is already serving " + dir.string());
+  }
+  // Requests claimed by a daemon that crashed were already withdrawn by
+  // their clients, the .work files are just leftovers
+  for (const auto& entry : fs::directory_iterator(dir)) {
+    if (entry.path().extension() == ".work") {
+      fs::remove(entry.path());
+    }
+  }
+  write_atomically(pid_file(), std::to_string(getpid()) + "\n");
+}
+
+// Remove the pid file, called when the daemon exits
+void QuerySpool::stop_serving() {
+  if (daemon_pid() == getpid()) {
+    fs::remove(pid_file());
+  }
+}
+
+// Claim the oldest pending request, if any
+std::optional<QuerySpool::Request> QuerySpool::next_request() {
+  std::string oldest;
+  for (const auto& entry : fs::directory_iterator(dir)) {
+    if (entry.path().extension() == ".req") {
+      auto id = entry.path().stem().string();
+      if (oldest.empty() || id < oldest) {
+        oldest = id;
+      }
+    }
+  }
+  if (oldest.empty()) {
+    std::this_thread::sleep_for(POLL_INTERVAL);
+    return std::nullopt;
+  }
+
+  // Claim it by renaming, this fails if the client withdrew it meanwhile
+  auto work = with_suffix(dir, oldest, ".work");
+  std::error_code err;
+  fs::rename(with_suffix(dir, oldest, ".req"), work, err);
+  if (err) {
+    return std::nullopt;
+  }
+
+  Request req;
+  req.id = oldest;
+  std::ifstream file(work);
+  std::string line;
+  while (std::getline(file, line)) {
+    auto space = line.find(' ');
+    if (space == std::string::npos) {
+      continue;
+    }
+    auto key = line.substr(0, space);
+    auto value = line.substr(space + 1);
+    if (key == "query") {
+      req.query = value;
+    } else if (key == "result") {
+      req.result = value;
+    } else if (key == "layout") {
+      req.layout = value;
+    } else if (key == "count_only") {
+      req.count_only = (value == "1");
+    } else if (key == "top_k") {
+      req.top_k = (value == "1");
+    }
+  }
+  if (req.query.empty() || req.result.empty()) {
+    complete(req, "malformed request " + work.string());
+    return std::nullopt;
+  }
+  return req;
+}
+
+// Report the outcome of a request, an empty error means success
+void QuerySpool::complete(const Request& req, const std::string& error) {
+  write_atomically(with_suffix(dir, req.id, ".done"),
+                   (error.empty() ? std::string("ok") : error) + "\n");
+  fs::remove(with_suffix(dir, req.id, ".work"));
+}
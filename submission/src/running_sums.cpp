@@ -135,20 +135,38 @@ void RunningSums::eval_in_place(
   // Now perform the shift-and-add procedure on ctxts[n-1],
   // each time adding the shifted ciphertext to all the cipehrtexts
   for (auto& phase_masks : this->masks) {
+    // All the rotations in a phase are of the same ciphertext, so if there
+    // is more than one we use the "hoisting" technique from
+    // https://ia.cr/2018/244, section 5: Break the ciphertext into digits
+    // (in NTT form) once, then apply the automorphism for each rotation
+    // amount to the digits and key-switch.
+    const auto& src = ctxts.back();
+    std::shared_ptr<std::vector<DCRTPoly>> digits;
+    if (phase_masks.size() > 1) {
+      digits = cc->EvalFastRotationPrecompute(src);
+    }
+    auto rotate = [this, &src, &digits](int amt) {
+      if (digits == nullptr) {
+        return cc->EvalRotate(src, amt);
+      }
+      return cc->EvalFastRotation(src, amt, cc->GetCyclotomicOrder(), digits);
+    };
+
     bool first = true;
     Ciphertext<DCRTPoly> acc;  // accumulator
     for (auto& [amt, mask] : phase_masks) {
       // Rotate the ctxt.back() by amt slots and multiply by the mask
       if (first) {
-        acc = cc->EvalRotate(ctxts.back(), amt);
+        acc = rotate(amt);
         acc = cc->EvalMult(acc, mask);
         first = false;
       } else {
-        auto tmp = cc->EvalRotate(ctxts.back(), amt);
+        auto tmp = rotate(amt);
         tmp = cc->EvalMult(tmp, mask);
         cc->EvalAddInPlace(acc, tmp);
       }
     }
+    digits = nullptr;  // release the memory before the next phase
     // Add to all the ciphertexts
     for (auto& ct : ctxts) {
       ct = cc->EvalAdd(ct, acc);
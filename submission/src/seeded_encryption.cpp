@@ -0,0 +1,205 @@
+// seeded_encryption.cpp - Secret-key encryption with a compressed `a` part
+//============================================================================
+// Copyright (c) 2025, Amazon Web Services
+// All rights reserved.
+//
+// This software is licensed under the terms of the Apache License v2.
+// See the file LICENSE.md for details.
+//============================================================================
+#include <cmath>
+#include <random>
+#include <stdexcept>
+
+#include "seeded_encryption.h"
+
+using namespace lbcrypto;
+
+// The ChaCha20 block function of RFC 8439, section 2.3
+static inline uint32_t rotl(uint32_t x, int n) {
+  return (x << n) | (x >> (32 - n));
+}
+static inline void quarter_round(uint32_t* x, int a, int b, int c, int d) {
+  x[a] += x[b]; x[d] = rotl(x[d] ^ x[a], 16);
+  x[c] += x[d]; x[b] = rotl(x[b] ^ x[c], 12);
+  x[a] += x[b]; x[d] = rotl(x[d] ^ x[a], 8);
+  x[c] += x[d]; x[b] = rotl(x[b] ^ x[c], 7);
+}
+static void chacha20_block(const uint32_t in[16], uint32_t out[16]) {
+  uint32_t x[16];
+  for (int i = 0; i < 16; i++) {
+    x[i] = in[i];
+  }
+  for (int i = 0; i < 10; i++) {  // 20 rounds, as 10 column+diagonal pairs
+    quarter_round(x, 0, 4, 8, 12);
+    quarter_round(x, 1, 5, 9, 13);
+    quarter_round(x, 2, 6, 10, 14);
+    quarter_round(x, 3, 7, 11, 15);
+    quarter_round(x, 0, 5, 10, 15);
+    quarter_round(x, 1, 6, 11, 12);
+    quarter_round(x, 2, 7, 8, 13);
+    quarter_round(x, 3, 4, 9, 14);
+  }
+  for (int i = 0; i < 16; i++) {
+    out[i] = x[i] + in[i];
+  }
+}
+
+// The key stream of ChaCha20 with the given key and nonce, as 64-bit words
+class ChaChaStream {
+  uint32_t state[16];
+  uint32_t block[16];
+  int pos = 16;  // the next unused word of block
+
+ public:
+  ChaChaStream(const PrgSeed& key, uint32_t nonce) {
+    state[0] = 0x61707865;  // "expand 32-byte k"
+    state[1] = 0x3320646e;
+    state[2] = 0x79622d32;
+    state[3] = 0x6b206574;
+    for (int i = 0; i < 8; i++) {
+      state[4 + i] = key[i];
+    }
+    state[12] = 0;  // the block counter
+    state[13] = nonce;
+    state[14] = state[15] = 0;
+  }
+
+  uint64_t next() {
+    if (pos >= 16) {
+      chacha20_block(state, block);
+      state[12]++;
+      pos = 0;
+    }
+    uint64_t w = block[pos] | (uint64_t(block[pos + 1]) << 32);
+    pos += 2;
+    return w;
+  }
+};
+
+PrgSeed random_seed() {
+  std::random_device rd;  // reads the OS random source on Linux
+  PrgSeed seed;
+  for (auto& w : seed) {
+    w = rd();
+  }
+  return seed;
+}
+
+// Tower t uses the stream with nonce t, and takes the low bits of each
+// word that are needed to represent its modulus, rejecting values >= q
+DCRTPoly expand_seed(const PrgSeed& seed,
+                     const std::shared_ptr<DCRTPoly::Params>& params) {
+  DCRTPoly a(params, Format::EVALUATION, true);
+  auto& towers = a.GetAllElements();
+  for (size_t t = 0; t < towers.size(); t++) {
+    uint64_t q = towers[t].GetModulus().ConvertToInt<uint64_t>();
+    int bits = 64 - __builtin_clzll(q);
+    uint64_t mask = (bits == 64) ? ~uint64_t(0) : (uint64_t(1) << bits) - 1;
+
+    ChaChaStream prg(seed, t);
+    size_t n = towers[t].GetLength();
+    for (size_t k = 0; k < n; k++) {
+      uint64_t w;
+      do {
+        w = prg.next() & mask;
+      } while (w >= q);
+      towers[t][k] = NativeInteger(w);
+    }
+  }
+  return a;
+}
+
+// The same as what OpenFHE does for cc->Encrypt(sk, pt), namely
+// b = m + e - a*s, except that a comes from the seed
+Ciphertext<DCRTPoly> encrypt_seeded(const PrivateKey<DCRTPoly>& sk,
+                                    const Plaintext& pt, PrgSeed& seed) {
+  const auto& m = pt->GetElement<DCRTPoly>();  // in evaluation form
+  auto params = m.GetParams();
+  size_t n_towers = m.GetNumOfElements();
+
+  // The secret key has all the towers, keep only those of the plaintext
+  DCRTPoly s = sk->GetPrivateElement();
+  if (s.GetNumOfElements() < n_towers) {
+    throw std::invalid_argument("encrypt_seeded: plaintext has more towers"
+                                " than the secret key");
+  }
+  s.DropLastElements(s.GetNumOfElements() - n_towers);
+
+  auto crypto_params =
+      std::dynamic_pointer_cast<CryptoParametersRLWE<DCRTPoly>>(
+          sk->GetCryptoParameters());
+  if (crypto_params == nullptr) {
+    throw std::invalid_argument("encrypt_seeded: not an RLWE scheme");
+  }
+  DCRTPoly e(crypto_params->GetDiscreteGaussianGenerator(), params,
+             Format::EVALUATION);
+
+  seed = random_seed();
+  DCRTPoly a = expand_seed(seed, params);
+  DCRTPoly b = m + e - a * s;
+
+  auto ct = std::make_shared<CiphertextImpl<DCRTPoly>>(
+      sk->GetCryptoContext(), sk->GetKeyTag(), pt->GetEncodingType());
+  ct->SetElements({std::move(b), std::move(a)});
+  ct->SetLevel(pt->GetLevel());
+  ct->SetNoiseScaleDeg(pt->GetNoiseScaleDeg());
+  ct->SetScalingFactor(pt->GetScalingFactor());
+  ct->SetSlots(pt->GetSlots());
+  return ct;
+}
+
+// The test vector of RFC 8439, section 2.3.2: key 00:01:02:...:1f, block
+// counter 1, and nonce 00:00:00:09:00:00:00:4a:00:00:00:00
+static void check_chacha20() {
+  const uint32_t in[16] = {
+      0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+      0x03020100, 0x07060504, 0x0b0a0908, 0x0f0e0d0c,
+      0x13121110, 0x17161514, 0x1b1a1918, 0x1f1e1d1c,
+      0x00000001, 0x09000000, 0x4a000000, 0x00000000};
+  const uint32_t expected[16] = {
+      0xe4e7f110, 0x15593bd1, 0x1fdd0f50, 0xc47120a3,
+      0xc7f4d1c7, 0x0368c033, 0x9aaa2204, 0x4e6cd4c3,
+      0x466482d2, 0x09aa9f07, 0x05d7c214, 0xa2028bd9,
+      0xd19c12b5, 0xb94e16de, 0xe883d0cb, 0x4e3c50a2};
+  uint32_t out[16];
+  chacha20_block(in, out);
+  for (int i = 0; i < 16; i++) {
+    if (out[i] != expected[i]) {
+      throw std::runtime_error("ChaCha20 does not match the test vector of"
+                               " RFC 8439, word " + std::to_string(i));
+    }
+  }
+}
+
+void check_seeded_encryption(const PrivateKey<DCRTPoly>& sk, uint32_t level) {
+  check_chacha20();
+
+  auto cc = sk->GetCryptoContext();
+  std::vector<double> values(cc->GetRingDimension() / 2);
+  for (size_t i = 0; i < values.size(); i++) {
+    values[i] = double(i % 256) / 256;
+  }
+  auto pt = cc->MakeCKKSPackedPlaintext(values, 1, level);
+  PrgSeed seed;
+  auto ct = encrypt_seeded(sk, pt, seed);
+
+  // The server and server_preprocess_dataset only get b and the seed
+  auto a = expand_seed(seed, pt->GetElement<DCRTPoly>().GetParams());
+  if (!(a == ct->GetElements()[1])) {
+    throw std::runtime_error("seeded encryption: the seed does not expand"
+                             " to the stored a");
+  }
+
+  Plaintext decrypted;
+  cc->Decrypt(sk, ct, &decrypted);
+  decrypted->SetLength(values.size());
+  auto slots = decrypted->GetRealPackedValue();
+  for (size_t i = 0; i < values.size(); i++) {
+    if (std::abs(slots[i] - values[i]) > 1e-3) {
+      throw std::runtime_error("seeded encryption: slot " +
+                               std::to_string(i) + " decrypts to " +
+                               std::to_string(slots[i]) + " rather than " +
+                               std::to_string(values[i]));
+    }
+  }
+}
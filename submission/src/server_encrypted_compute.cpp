@@ -6,7 +6,12 @@
 // This software is licensed under the terms of the Apache License v2.
 // See the file LICENSE.md for details.
 //============================================================================
+#include <unistd.h>
+
 #include <cassert>
+#include <csignal>
+#include <memory>
+#include <numeric>
 
 #include "openfhe.h"
 #include "cryptocontext-ser.h"  // header files needed for (de)serialization
@@ -16,8 +21,15 @@
 
 #include "params.h"
 #include "utils.h"
+#include "parallel.h"
+#include "prefetch.h"
+#include "mult_accumulator.h"
+#include "encrypted_db.h"
+#include "query_spool.h"
 #include "slot_replication.h"
 #include "running_sums.h"
+#include "chebyshev.h"
+#include "ivf.h"
 
 using namespace lbcrypto;
 
@@ -26,17 +38,6 @@ using namespace lbcrypto;
 PrivateKey<DCRTPoly> sk;
 #endif
 
-// A utility function to get one encrypted ciphertext from the dataset. This
-// implementation assumes that ciphertexts are just separate files on disk,
-// it should be re-written if they are streamed from a remote location.
-inline Ciphertext<DCRTPoly> get_ctxt(fs::path ct_name) {
-  Ciphertext<DCRTPoly> ct;
-  if (!Serial::DeserializeFromFile(ct_name, ct, SerType::BINARY)) {
-    throw std::runtime_error("failed to read ciphertext from " + ct_name.string());
-  }
-  return ct;
-}
-
 // Print logging information to stdout
 void log_step(int num, std::string name) {
   auto [timestamp, duration] = getCurrentTimeFormatted();
@@ -47,30 +48,48 @@ void log_step(int num, std::string name) {
   std::cout << std::endl;
 }
 
-// Matrix-vector product: The matrix rows are stored on disk in batches
-// under iodir/<size>/encrypted/batchNNNN/. The query ciphertext contains
-// the query vector, repeatd to fill in all the slots.
-std::vector<Ciphertext<DCRTPoly>> mat_vec_mult(fs::path encdir,
-                Ciphertext<DCRTPoly> qry, const InstanceParams& prms);
+// Matrix-vector products of the same matrix with several query vectors:
+// The matrix rows are stored on disk in batches under
+// iodir/<size>/server/batchNNNN/. Each query ciphertext contains its query
+// vector, repeatd to fill in all the slots, and each has its own replicator
+// that was built for that pattern. Only the rows of the given batches are
+// used. The rows are read by n_readers threads, up to prefetch_depth of
+// them ahead of their use, and each row is used with all the queries.
+// Returns one vector of ciphertexts per query, one per batch.
+std::vector<std::vector<Ciphertext<DCRTPoly>>> mat_vec_mult(
+                const EncryptedDB& db, const std::vector<int>& batches,
+                const std::vector<DFSSlotReplicator*>& replicators,
+                std::vector<Ciphertext<DCRTPoly>>& qrys,
+                const InstanceParams& prms,
+                size_t prefetch_depth, int n_readers);
 
-// Compare each slot in the ctxts to the threshold, using a Chebyshev
-// approximation of the indicator function chi(x) = (x >= threshold).
+// Compare each slot in the ctxts to each of the thresholds, using Chebyshev
+// approximations of the indicator functions chi_t(x) = (x >= threshold[t]).
 // Rather than approximating 0/1 outcome, we scale it to 0/0.5, since we
 // will sum up upto eight matches, then multiply by the original thing,
 // and need to fit the result to a size-2 interval that can be shifted
-// to [+-1].
-void compare_to_threshold(std::vector<Ciphertext<DCRTPoly>>& ctxts,
-                          double threshold, bool count_only);
+// to [+-1]. Returns one vector of indicators per threshold.
+std::vector<std::vector<Ciphertext<DCRTPoly>>> compare_to_thresholds(
+    const std::vector<Ciphertext<DCRTPoly>>& ctxts,
+    const std::vector<double>& thresholds, bool count_only);
+
+// Compare each slot in the ctxts to a ladder of decreasing thresholds.
+// Returns one vector per band [ladder[b],ladder[b-1]), with the indicators
+// of the slots in that band (the first band has no upper bound), scaled to
+// 0/0.5 as in compare_to_thresholds.
+std::vector<std::vector<Ciphertext<DCRTPoly>>> compare_to_ladder(
+    const std::vector<Ciphertext<DCRTPoly>>& ctxts,
+    const std::vector<double>& ladder);
 
-// Compare each slot in the ciphertexts to the number, using a Chebyshev
-// approximation of the function chi(x) = (x == number).
-std::vector<Ciphertext<DCRTPoly>> compare_to_number(
-    const std::vector<Ciphertext<DCRTPoly>>& ctxts, double number);
+// The Chebyshev series approximating the functions chi_i(x)=(x==numbers[i])
+std::vector<std::vector<double>> impulse_series(
+    const std::vector<double>& numbers);
 
-// Read from disk the ith payload value of all the records, namely the
-// i'th row of the payload matrix.
-Ciphertext<DCRTPoly> get_encrypted_payload(fs::path datadir, size_t batch,
-                                            size_t idx);
+// Compare each slot in the ciphertext to each of the numbers, using the
+// series from impulse_series(numbers). Returns one indicator per number.
+std::vector<Ciphertext<DCRTPoly>> compare_to_numbers(
+    const Ciphertext<DCRTPoly>& ct,
+    const std::vector<std::vector<double>>& series);
 
 // A SIMD-optimized procedure for computing total sums. The slots are viewed
 // as a matrix, and total sums are computed in each column separately.
@@ -97,28 +116,181 @@ static void printCts(
   }
 }
 #endif
+/*******************************************************************/
+// Everything that the server loads once and then uses for every query
+struct ServerState {
+  const InstanceParams prms;
+  CryptoContext<DCRTPoly> cc;
+  std::unique_ptr<EncryptedDB> db;
+  // One replicator per query that is processed together with others,
+  // more are added as needed, see process_queries
+  std::vector<std::unique_ptr<DFSSlotReplicator>> replicators;
+  std::unique_ptr<RunningSums> rs;  // built on first use, see finish_query
+  size_t prefetch_depth;
+  int n_readers;
+
+  ServerState(InstanceSize size, int reduced_dim, bool complex_slots)
+      : prms(size, reduced_dim, complex_slots) {}
+};
+
+// Read the keys from disk and map the dataset
+void load_server_state(ServerState& st);
+
+// The batches to scan for the given query files: the union of their
+// probe lists, or all the batches if some query has none (see ivf.h).
+// This is empty if all the probe lists are empty.
+std::vector<int> scan_batches(const std::vector<fs::path>& query_files,
+                              int n_batches);
+
+// Run the encrypted computation on a few queries, making a single pass
+// over the rows of the given batches for all of them. Returns one result
+// per query and threshold, the one for query q and thresholds[t] at index
+// q*thresholds.size()+t (a single result per query with top_k).
+std::vector<Ciphertext<DCRTPoly>> process_queries(ServerState& st,
+    std::vector<Ciphertext<DCRTPoly>>& eqrys,
+    const std::vector<int>& batches, const std::vector<double>& thresholds,
+    bool count_only, bool top_k);
+
+// The rest of the computation for one query, after the matrix-vector
+// product: compare to the thresholds, then count or fetch the payloads,
+// with one result per threshold. With top_k, fetch the payloads of the
+// best matches by TOP_K_LADDER instead, in a single result.
+std::vector<Ciphertext<DCRTPoly>> finish_query(ServerState& st,
+    std::vector<Ciphertext<DCRTPoly>>& result,
+    const std::vector<int>& batches, const std::vector<double>& thresholds,
+    bool count_only, bool top_k);
+
+// Answer queries from the spool until asked to stop by SIGINT/SIGTERM
+void serve(ServerState& st, QuerySpool& spool);
+
 /*******************************************************************/
 int main(int argc, char* argv[]) {
   if (argc < 2 || !std::isdigit(argv[1][0])) {
-    std::cout << "Usage: " << argv[0] << " instance-size [--count_only]\n";
+    std::cout << "Usage: " << argv[0] << " instance-size [--count_only]"
+              << " [--num_queries Q] [--daemon] [--threads N]"
+              << " [--prefetch K] [--readers R] [--reduce_dim D]"
+              << " [--complex_slots] [--top_k] [--thresholds T1,T2,...]\n";
     std::cout << "  Instance-size: 0-TOY, 1-SMALL, 2-MEDIUM, 3-LARGE\n";
+    std::cout << "  --num_queries: answer Q queries (query_NNNN.bin) with a"
+              << " single pass over the dataset (default: 1)\n";
+    std::cout << "  --daemon: load keys and dataset once, then keep answering"
+              << " queries until killed\n";
+    std::cout << "  --threads: # of threads to use (default: all cores)\n";
+    std::cout << "  --prefetch: # of dataset ciphertexts to read ahead"
+              << " (default: 2 per thread)\n";
+    std::cout << "  --readers: # of threads reading them (default: 2)\n";
+    std::cout << "  --reduce_dim: the records were projected to dimension D"
+              << " (default: no projection, see projection.h)\n";
+    std::cout << "  --complex_slots: the records were encrypted with two"
+              << " entries per slot (see params.h)\n";
+    std::cout << "  --top_k: rather than the matches above the threshold,"
+              << " return a share of each column\n"
+              << "    for each band of TOP_K_LADDER, for client_postprocess"
+              << " --top_k K. Not an exact\n"
+              << "    top-k: matches below the last band are never"
+              << " returned, extra matches of a band\n"
+              << "    are dropped, and too many garble the column"
+              << " (see params.h)\n";
+    std::cout << "  --thresholds: answer every query for each of these"
+              << " thresholds, with one pass over\n"
+              << "    the dataset. The answer for query q and threshold t is"
+              << " results_NNNN.bin with\n"
+              << "    NNNN=q*#thresholds+t (default: "
+              << DEFAULT_THRESHOLD << ")\n";
     return 0;
   }
   auto size = static_cast<InstanceSize>(std::stoi(argv[1]));
-  bool count_only = (argc > 2 && std::string(argv[2])=="--count_only");
+  bool count_only = has_flag(argc, argv, "--count_only");
+  bool top_k = has_flag(argc, argv, "--top_k");
+  if (count_only && top_k) {
+    throw std::invalid_argument("--top_k returns payloads, not a count");
+  }
+  auto thresholds = get_list_option(argc, argv, "--thresholds",
+                                    {DEFAULT_THRESHOLD});
+  for (double t : thresholds) {
+    if (!(t > -1.0 && t < 1.0)) {
+      throw std::invalid_argument("--thresholds must be in (-1,1)");
+    }
+  }
+  if (top_k && thresholds.size() > 1) {
+    throw std::invalid_argument("--top_k uses its own thresholds");
+  }
+  // # of answers per query
+  int n_answers = top_k ? 1 : thresholds.size();
+  bool daemon = has_flag(argc, argv, "--daemon");
+  set_num_threads(get_int_option(argc, argv, "--threads", 0));
 
-  InstanceParams prms(size);
-  constexpr double threshold = 0.8;
+  ServerState st(size, get_int_option(argc, argv, "--reduce_dim", 0),
+                 has_flag(argc, argv, "--complex_slots"));
+  st.prefetch_depth =
+      get_int_option(argc, argv, "--prefetch", 2 * get_num_threads());
+  st.n_readers = get_int_option(argc, argv, "--readers", 2);
+  int n_queries = get_int_option(argc, argv, "--num_queries", 1);
+  if (n_queries < 1) {
+    throw std::invalid_argument("--num_queries must be positive");
+  }
 
-  // Read the crypto context and the public key from disk
-  CryptoContext<DCRTPoly> cc;
-  if (!Serial::DeserializeFromFile(prms.keydir()/"cc.bin", cc, SerType::BINARY)) {
-    throw std::runtime_error("Failed to get CryptoContext from "+prms.keydir().string());
+  // If a daemon is already serving this instance then let it do the work,
+  // otherwise (or if the daemon goes away midway) do it ourselves. The
+  // daemon answers one query per request at the default threshold, so a
+  // batch of queries or of thresholds is always computed here.
+  QuerySpool spool(st.prms.srvdir()/"spool");
+  if (!daemon && n_queries == 1 && thresholds.size() == 1 &&
+      thresholds[0] == DEFAULT_THRESHOLD && spool.daemon_pid() != 0) {
+    auto id = spool.submit(st.prms.encdir()/"query.bin",
+                           st.prms.encdir()/"results.bin",
+                           st.prms.getLayout(), count_only, top_k);
+    if (spool.wait(id)) {
+      log_step(4, "Query answered by server daemon");
+      return 0;
+    }
+    std::cout << "         [server] daemon exited, computing locally\n";
+  }
+
+  load_server_state(st);
+  log_step(0, "Loading keys");
+
+  if (daemon) {
+    serve(st, spool);
+    return 0;
   }
-  PublicKey<DCRTPoly> pk;
-  if (!Serial::DeserializeFromFile(prms.keydir()/"pk.bin", pk, SerType::BINARY)) {
-    throw std::runtime_error("Failed to get public key from "+prms.keydir().string());
+
+  // Read the query vectors from disk
+  std::vector<Ciphertext<DCRTPoly>> eqrys(n_queries);
+  std::vector<fs::path> q_fnames;
+  for (int q = 0; q < n_queries; q++) {
+    q_fnames.push_back(query_file(st.prms.encdir(), "query", q, n_queries));
+    if (!Serial::DeserializeFromFile(q_fnames[q],eqrys[q],SerType::BINARY)){
+      throw std::runtime_error(
+        "failed to read query ciphertext from " + q_fnames[q].string());
+    }
+  }
+  auto batches = scan_batches(q_fnames, st.db->n_batches());
+  auto results = process_queries(st, eqrys, batches, thresholds, count_only,
+                                 top_k);
+
+  // Store the results back to disk
+  for (int q = 0; q < n_queries * n_answers; q++) {
+    auto out_fname = query_file(st.prms.encdir(), "results", q,
+                                n_queries * n_answers);
+    if (!Serial::SerializeToFile(out_fname, results[q], SerType::BINARY)) {
+      throw std::runtime_error("Failed to write ciphertext to " +
+                               out_fname.string());
+    }
   }
+  return 0;
+}
+
+/*******************************************************************/
+// Read the keys from disk and map the dataset
+void load_server_state(ServerState& st) {
+  const auto& prms = st.prms;
+
+  // Read the crypto context from disk
+  if (!Serial::DeserializeFromFile(prms.keydir()/"cc.bin", st.cc, SerType::BINARY)) {
+    throw std::runtime_error("Failed to get CryptoContext from "+prms.keydir().string());
+  }
+  auto cc = st.cc;
 #ifdef DEBUG // Read also the secret key for debugging
   if (!Serial::DeserializeFromFile(prms.keydir()/"sk.bin", sk, SerType::BINARY)) {
     throw std::runtime_error("Failed to get secret key from "+prms.keydir().string());
@@ -139,21 +311,176 @@ int main(int argc, char* argv[]) {
       "Failed to get rotation keys from " +prms.keydir().string());
   }
 
-  // Read the query vector from disk
-  auto q_fname = prms.encdir()/"query.bin";
-  Ciphertext<DCRTPoly> eqry;
-  if (!Serial::DeserializeFromFile(q_fname,eqry,SerType::BINARY)){
-    throw std::runtime_error(
-      "failed to read query ciphertext from " + q_fname.string());
+  // Map the containers of the server's copy of the encrypted dataset,
+  // as prepared by server_preprocess_dataset
+  st.db = std::make_unique<EncryptedDB>(cc, prms.srvdir(), prms.getNCtxts());
+
+  // The input ciphertext includes a pattern of length NROWS (RECORD_DIM,
+  // or half of it with complex slots), repeated N_SLOTS/NROWS many times
+  // to fill all the slot. The replicator pre-computes its masks, and can be
+  // reused across queries.
+  auto n_reps = prms.getNSlots() / prms.getNRows();
+  st.replicators.push_back(
+      std::make_unique<DFSSlotReplicator>(cc, prms.getDegrees(), n_reps));
+}
+
+/*******************************************************************/
+// Answer queries from the spool until asked to stop by SIGINT/SIGTERM
+static volatile std::sig_atomic_t stop_requested = 0;
+extern "C" void on_stop_signal(int) { stop_requested = 1; }
+
+void serve(ServerState& st, QuerySpool& spool) {
+  // The dataset is used by every query, so keep it in memory
+  st.db->keep_resident();
+
+  std::signal(SIGINT, on_stop_signal);
+  std::signal(SIGTERM, on_stop_signal);
+  spool.start_serving();
+  std::cout << "         [server] daemon " << getpid()
+            << " is ready for queries" << std::endl;
+
+  while (!stop_requested) {
+    auto req = spool.next_request();
+    if (!req) {
+      continue;
+    }
+    getCurrentTimeFormatted();  // restart the step timer for this query
+    std::cout << "         [server] daemon answering request " << req->id
+              << std::endl;
+    try {
+      // A query with another layout would give wrong results, not an error
+      if (req->layout != st.prms.getLayout()) {
+        throw std::invalid_argument("the query has layout '" + req->layout +
+                                    "', the daemon serves '" +
+                                    st.prms.getLayout() + "'");
+      }
+      std::vector<Ciphertext<DCRTPoly>> eqry(1);
+      if (!Serial::DeserializeFromFile(req->query, eqry[0], SerType::BINARY)) {
+        throw std::runtime_error(
+          "failed to read query ciphertext from " + req->query.string());
+      }
+      auto batches = scan_batches({req->query}, st.db->n_batches());
+      auto result = process_queries(st, eqry, batches, {DEFAULT_THRESHOLD},
+                                    req->count_only, req->top_k)[0];
+      if (!Serial::SerializeToFile(req->result, result, SerType::BINARY)) {
+        throw std::runtime_error("Failed to write ciphertext to " +
+                                 req->result.string());
+      }
+      spool.complete(*req);
+    } catch (const std::exception& e) {  // report it and keep serving
+      std::cerr << "         [server] request " << req->id << " failed: "
+                << e.what() << std::endl;
+      spool.complete(*req, e.what());
+    }
+  }
+  spool.stop_serving();
+}
+
+/*******************************************************************/
+// The batches to scan for the given query files: the union of their
+// probe lists, or all the batches if some query has none (see ivf.h)
+std::vector<int> scan_batches(const std::vector<fs::path>& query_files,
+                              int n_batches)
+{
+  std::vector<std::vector<int>> probes;
+  for (const auto& fname : query_files) {
+    auto probe = read_probe(probe_file(fname));
+    if (!probe) {  // scan everything for this query
+      probes.assign(1, std::vector<int>(n_batches));
+      std::iota(probes[0].begin(), probes[0].end(), 0);
+      break;
+    }
+    for (int b : *probe) {
+      if (b < 0 || b >= n_batches) {
+        throw std::runtime_error(probe_file(fname).string() +
+                                 ": no batch #" + std::to_string(b));
+      }
+    }
+    probes.push_back(std::move(*probe));
+  }
+  auto batches = vector_union(probes);
+  if (int(batches.size()) < n_batches) {
+    std::cout << "         [server] scanning " << batches.size() << " of "
+              << n_batches << " batches (inverted-file probe lists)\n";
+  }
+  return batches;
+}
+
+// Run the encrypted computation on a few queries, making a single pass
+// over the rows of the given batches for all of them. The matrix-vector
+// product is shared by all the thresholds.
+//
+// NOTE: We do not pack several queries into one query ciphertext. Slot s
+// of a row ciphertext holds an entry of record s, so for P queries in one
+// ciphertext to each meet every record, every record would have to be
+// repeated in P slots. The dataset and payloads would then be P times
+// larger, and the number of ciphertext products, which dominates the
+// cost, would be the same as for P separate queries. Packing would only
+// share the replication of the query, which is small next to the
+// products, and would leave each query just NCols/P columns for its
+// matches. A single pass for all the queries, as here, already shares the
+// reading of the dataset.
+std::vector<Ciphertext<DCRTPoly>> process_queries(ServerState& st,
+    std::vector<Ciphertext<DCRTPoly>>& eqrys,
+    const std::vector<int>& batches, const std::vector<double>& thresholds,
+    bool count_only, bool top_k)
+{
+  const auto& prms = st.prms;
+
+  // With no batch to scan (empty probe lists), every answer is an exact
+  // encryption of zero, which decodes to no matches or a count of zero
+  if (batches.empty()) {
+    size_t n_answers = top_k ? 1 : thresholds.size();
+    std::vector<Ciphertext<DCRTPoly>> results;
+    for (const auto& eqry : eqrys) {
+      for (size_t t = 0; t < n_answers; t++) {
+        results.push_back(st.cc->EvalSub(eqry, eqry));
+      }
+    }
+    return results;
+  }
+
+  // Each query needs its own replicator, they all have the same masks
+  auto n_reps = prms.getNSlots() / prms.getNRows();
+  while (st.replicators.size() < eqrys.size()) {
+    st.replicators.push_back(
+        std::make_unique<DFSSlotReplicator>(st.cc, prms.getDegrees(), n_reps));
+  }
+  std::vector<DFSSlotReplicator*> replicators;
+  for (size_t q = 0; q < eqrys.size(); q++) {
+    replicators.push_back(st.replicators[q].get());
   }
-  log_step(0, "Loading keys");
 
   // Matrix-vector multiplication, reading the encrypted matrix one
-  // ciphertexe at a time from encdir
-  auto result = mat_vec_mult(prms.encdir(), eqry, prms);
+  // ciphertexe at a time from the dataset containers
+  auto mat_vec_results = mat_vec_mult(*st.db, batches, replicators, eqrys,
+                                      prms, st.prefetch_depth, st.n_readers);
   log_step(1, "Matrix-vector product");
 
-  // Compare each slot in the results ctxts to the threshold, using a
+  // The rest of the computation is done for one query at a time
+  std::vector<Ciphertext<DCRTPoly>> results;
+  for (auto& result : mat_vec_results) {
+    auto answers = finish_query(st, result, batches, thresholds, count_only,
+                                top_k);
+    results.insert(results.end(), answers.begin(), answers.end());
+    result.clear();  // release the memory
+  }
+  return results;
+}
+
+// The rest of the computation for one query, after the matrix-vector
+// product: compare to the thresholds, then count or fetch the payloads.
+// result[k] is the product for batch #batches[k].
+std::vector<Ciphertext<DCRTPoly>> finish_query(ServerState& st,
+    std::vector<Ciphertext<DCRTPoly>>& result,
+    const std::vector<int>& batches, const std::vector<double>& thresholds,
+    bool count_only, bool top_k)
+{
+  const auto& prms = st.prms;
+  const auto& db = *st.db;
+  auto cc = st.cc;
+
+  // Compare each slot in the results ctxts to the thresholds, using a
   // Chebyshev approximation of the indicator function chi(x)=(x>=threshold).
   // If we only want to count the matches, then we use use a higher-degree
   // approximation since (a) we care about good approximation for both matches
@@ -163,37 +490,44 @@ int main(int argc, char* argv[]) {
   // them). Also, we scale it to 0/0.5 rather than 0/1, since we sum up upto
   // eight matches, then multiply by the original thing, and need to fit the
   // result to a size-2 interval that can be shifted to the interval [-1,1].
-  compare_to_threshold(result, threshold, count_only);
+  // groups[t][k] has the matches of batch k for thresholds[t], and there
+  // is one answer per threshold. In top-k mode, groups[b][k] instead has
+  // the matches of batch k in band b of TOP_K_LADDER, and the bands share
+  // a single answer. Either way all the groups use the same degree and
+  // scale, and are evaluated on one Chebyshev basis per batch.
+  std::vector<std::vector<Ciphertext<DCRTPoly>>> groups;
+  if (top_k) {
+    if (count_only || prms.getMaxNMatch() % TOP_K_LADDER.size() != 0) {
+      throw std::invalid_argument("top-k mode needs payloads and a ladder of"
+                                  " thresholds whose size divides " +
+                                  std::to_string(prms.getMaxNMatch()));
+    }
+    groups = compare_to_ladder(result, TOP_K_LADDER);
+  } else {
+    groups = compare_to_thresholds(result, thresholds, count_only);
+  }
+  result.clear();  // not needed anymore
   log_step(2, "Compare to threshold");
 #ifdef DEBUG
-    printCts(result, " match vector:");
+    printCts(groups[0], " match vector:");
 #endif
 
-  // If we only want to count matches, return the total sum
-  // of all the slots in all the ciphertexts.
+  // If we only want to count matches, return for every threshold the
+  // total sum of all the slots in all the ciphertexts.
   if (count_only) {
-    for (size_t i=1; i<result.size(); i++) {
-      cc->EvalAddInPlace(result[0], result[i]);
+    std::vector<Ciphertext<DCRTPoly>> counts;
+    for (auto& group : groups) {
+      for (size_t i=1; i<group.size(); i++) {
+        cc->EvalAddInPlace(group[0], group[i]);
+      }
+      group[0] = cc->EvalSum(group[0], prms.getNSlots());
+      counts.push_back(group[0]);
     }
-    result[0] = cc->EvalSum(result[0], prms.getNSlots());
     log_step(3, "Summation");
 #ifdef DEBUG
-    printCts({result[0]}, " summed match vector:");
+    printCts(counts, " summed match vector:");
 #endif
-
-    std::string out_fname = prms.encdir()/"results.bin";
-    if (!Serial::SerializeToFile(out_fname, result[0], SerType::BINARY)) {
-      throw std::runtime_error("Failed to write ciphertext to " + out_fname);
-    }
-    return 0;
-  }
-
-  // Make a deep copy of the matches, it will be multiplied back into the
-  // result after the running-sum procedure
-  std::vector<Ciphertext<DCRTPoly>> matches;
-  matches.reserve(result.size());
-  for (auto& ct : result) {
-    matches.push_back(ct->Clone());
+    return counts;
   }
 
   // The "compaction" procedure views the matches vector (made of multiple
@@ -209,21 +543,44 @@ int main(int argc, char* argv[]) {
   // This represents a matrix with i'th column being [ai bi ci di ei fi]^t,
   // we expect no more than 8 ones in each column.
 
+  // Every group is compacted separately. With several thresholds, each
+  // one gets its own answer with up to eight matches per column. In top-k
+  // mode, each band gets its own share of the eight matches per column of
+  // the single answer: band b gets the matches b*m+1,...,(b+1)*m for
+  // m=8/#bands, so a column of the answer lists its matches from the best
+  // band down. Matches beyond the first m of a band in a column are dropped,
+  // and with more than eight of them the running sums of the band leave the
+  // domain of the impulse series, so that column of the answer is garbage.
+  // The server cannot detect either case, as it never sees the counts.
+
   // Running sums in each column, so the first match will have value 1,
   // the second match will have 2, etc.
-  RunningSums rs(cc,prms.getNCols(),RUNNING_SUM_LEVELS,result[0]->GetLevel());
-  rs.eval_in_place(result);  // The actual running-sums procedure
-
-  // Multiply by the matches vector, to zero out all the non-matches
-  for (size_t i = 0; i < result.size(); i++) {
-    result[i] = cc->EvalMult(result[i], matches[i]);
+  // The masks of the RunningSums object are encoded at the level of its
+  // input, which is the same for all queries, so it is built only once.
+  if (st.rs == nullptr) {
+    st.rs = std::make_unique<RunningSums>(
+        cc, prms.getNCols(), RUNNING_SUM_LEVELS, groups[0][0]->GetLevel());
   }
-  matches.clear();          // not needed anymore
-  matches.shrink_to_fit();  // release the memory
+  for (auto& group : groups) {
+    // Make a deep copy of the matches, it will be multiplied back into the
+    // result after the running-sum procedure
+    std::vector<Ciphertext<DCRTPoly>> matches;
+    matches.reserve(group.size());
+    for (auto& ct : group) {
+      matches.push_back(ct->Clone());
+    }
+    st.rs->eval_in_place(group);  // The actual running-sums procedure
 
-  // Contents of slots are now in the range [0,2], shift them to [-1,1]
-  for (auto& ct : result) {
-    cc->EvalSubInPlace(ct, 1.0);
+    // Multiply by the matches vector, to zero out all the non-matches
+    for (size_t i = 0; i < group.size(); i++) {
+      group[i] = cc->EvalMult(group[i], matches[i]);
+    }
+    matches.clear();  // not needed anymore
+
+    // Contents of slots are now in the range [0,2], shift them to [-1,1]
+    for (auto& ct : group) {
+      cc->EvalSubInPlace(ct, 1.0);
+    }
   }
   log_step(3, "Running sums");
 
@@ -258,44 +615,106 @@ int main(int argc, char* argv[]) {
   //   {i*PAYLOAD_DIM,...,(i+1)*PAYLOAD_DIM-1} in each column and zero
   //   elsewhere.
 
-  Ciphertext<DCRTPoly> accumulator;
-  for (int i = 1; i <= prms.getMaxNMatch(); i++) {  // extract i'th match
-    double x_i = i / 4.0 - 1.0;  // map from {0,8} to the interval [-1,1]
-    auto indicator = compare_to_number(result, x_i);
+  // The different i's are independent until step 3, so rather than going
+  // over the payloads once for every i, we go over them once and apply all
+  // the MAX_N_MATCH(=8) indicators to each one. We go over the batches one
+  // at a time: compute the indicators for the batch, then read its
+  // PAYLOAD_DIM payload ciphertexts and multiply each of them by all the
+  // indicators, adding the products to acc[i][j]. The payloads are read by
+  // reader threads ahead of their use, in the order (k=0,j=0),
+  // (k=0,j=1), ...
+  // With several groups of m matches per column, indicator g*m+i-1 is for
+  // the i'th match of group g, and all of them are applied to the payloads
+  // in the same pass.
+  int n_batches = batches.size();
+  int per_group = top_k ? prms.getMaxNMatch() / groups.size()
+                        : prms.getMaxNMatch();
+  int n_match = per_group * groups.size();  // # of indicators per batch
+  std::vector<double> numbers;
+  for (int i = 1; i <= per_group; i++) {
+    numbers.push_back(i / 4.0 - 1.0);  // map from {0,8} to the interval [-1,1]
+  }
+  auto impulses = impulse_series(numbers);
+
+  CtxtPrefetcher payloads(size_t(n_batches) * PAYLOAD_DIM,
+                          [&db, &batches](size_t idx) {
+                            return db.get_payload(batches[idx / PAYLOAD_DIM],
+                                                  idx % PAYLOAD_DIM);
+                          },
+                          st.prefetch_depth, st.n_readers);
+  uint64_t bytes_read = 0;
+
+  // acc[i-1][j] holds the sum over all batches of payload_j*indicator_i,
+  // before relinearization
+  std::vector<std::vector<Ciphertext<DCRTPoly>>> acc(
+      n_match, std::vector<Ciphertext<DCRTPoly>>(PAYLOAD_DIM));
+  // The indicators are computed for a chunk of batches in parallel, then
+  // the payloads of these batches are processed one batch at a time.
+  int chunk = get_num_threads();
+  std::vector<std::vector<Ciphertext<DCRTPoly>>> chunk_indicators;
+  for (int k = 0; k < n_batches; k++) {
+    if (k % chunk == 0) {
+      int k0 = k;
+      chunk_indicators.assign(std::min(chunk, n_batches - k0), {});
+      parallel_for_stealing(int(chunk_indicators.size()), [&](int c) {
+        // Indicator i has a "one hot" vector per column, containing 1 in
+        // slots where partial_sums contained i
+        for (auto& group : groups) {
+          auto ind = compare_to_numbers(group[k0 + c], impulses);
+          chunk_indicators[c].insert(chunk_indicators[c].end(),
+                                     ind.begin(), ind.end());
+          group[k0 + c] = nullptr;  // not needed anymore
+        }
+      });
+    }
+    const auto& indicators = chunk_indicators[k % chunk];
 
-    // Indicator has as many ciphertexe as it takes to store a row of the keys
-    // matrix (i.e., one slot for each dataset recrod). It's a "one hot" vector
-    // vector per column, containing 1 in slots where partial_sums contained i
+    for (size_t j = 0; j < PAYLOAD_DIM; j++) {
+      // Step 1: Multiply the jth payload in the k'th batch by the indicators
+      // to get a single payload value per column.
+      // We assume that each indicator has a single 1 in each output column
+      // and all else are zero. So for each slot index s<N_SLOTS, at most one
+      // of the values added to acc[i][j][s] will be non-zero. This let us
+      // use a single cipehrtext for acc[i][j], even though the indicator
+      // is a vector of ciphertexts, we just add everything and are assured
+      // that at most one of the terms is non-zero.
+      auto payload = payloads.get(size_t(k) * PAYLOAD_DIM + j);
+      bytes_read += db.payload_bytes(batches[k], j);
+      parallel_for(n_match, [&](int i) {
+        auto product = cc->EvalMultNoRelin(payload, indicators[i]);
+        if (k == 0) {  // initialize the accumulator
+          acc[i][j] = product;
+        } else {
+          cc->EvalAddInPlace(acc[i][j], product);
+        }
+      });
+    }
+  }
+  std::cout << "         [server] read " << (bytes_read >> 20)
+            << "MB of payloads, " << payloads.report() << std::endl;
 
+  // Indicator g*m+i-1 goes to match i of answer g, or in top-k mode to
+  // match g*m+i of the single answer
+  std::vector<Ciphertext<DCRTPoly>> accumulators(top_k ? 1 : groups.size());
+  for (int ind = 0; ind < n_match; ind++) {
+    auto& accumulator = accumulators[top_k ? 0 : ind / per_group];
+    int i = top_k ? ind + 1 : ind % per_group + 1;  // extract i'th match
     // A place holder for the extracted payload, before moving them to
     // their place in the output columns.
     Ciphertext<DCRTPoly> to_replicate;
     for (size_t j = 0; j < PAYLOAD_DIM; j++) {
-      // Steps 1 & 2: Multiply by the indicator to get a single payload value
-      // per column, then rotate by j*N_COLS to put that value in the next
-      // available slot in its column.
-      for (size_t k = 0; k < indicator.size(); k++) {
-        auto payload_part = get_encrypted_payload(prms.encdir(), k, j);
-        // jth row in the k'th matrix
-
-        payload_part = cc->EvalMult(payload_part, indicator[k]);
-
-        // Shift the j'th payload value by j positions in its column, so we
-        // pack all PAYLOAD_DIM=8 values consecutively in their column.
-        if (j == 0 && k == 0) {   // initialize the inner-loop accumulator
-          to_replicate = payload_part->Clone();
-        } else {
-          if (j != 0) {  // shift by j in its column
-            payload_part = cc->EvalRotate(payload_part, -j * prms.getNCols());
-          }
-          to_replicate = cc->EvalAdd(to_replicate,payload_part);  // accumulate
-        }
-        // We assume that indicator has a single 1 in each output column and
-        // all else are zero. So for each slot index s<N_SLOTS, at most one
-        // of the values added to to_replicate[s] will be non-zero. This let us
-        // use a single cipehrtext for to_replicate, even though the indicator
-        // is a vector of ciphertexts, we just add everything and are assured
-        // that at most one of the terms is non-zero.
+      auto& payload_j = acc[ind][j];
+      cc->RelinearizeInPlace(payload_j);
+
+      // Step 2: Shift the j'th payload value by j positions in its column,
+      // so we pack all PAYLOAD_DIM=8 values consecutively in their column.
+      // Rotation is linear, so rotating the sum over all the batches is the
+      // same as rotating each term, and it takes a single key-switching.
+      if (j == 0) {
+        to_replicate = payload_j;
+      } else {
+        payload_j = cc->EvalRotate(payload_j, -j * prms.getNCols());
+        cc->EvalAddInPlace(to_replicate, payload_j);
       }
     }
 
@@ -319,74 +738,160 @@ int main(int argc, char* argv[]) {
     auto masked = cc->EvalMult(replicated, mask);
 
     // Finally, add the payload values to all the other matches in that column
-    if (i == 1) {  // initialize the outter accumulator
+    if (accumulator == nullptr) {  // initialize the outter accumulator
       accumulator = masked;
     } else {
       accumulator = cc->EvalAdd(accumulator, masked);
     }
   }
   log_step(4, "Output compression");
-
-  // Store the accumulated result back to disk
-  std::string out_fname = prms.encdir()/"results.bin";
-  if (!Serial::SerializeToFile(out_fname, accumulator, SerType::BINARY)) {
-    throw std::runtime_error("Failed to write ciphertext to " + out_fname);
-  }
-  return 0;
+  return accumulators;
 }
 /*******************************************************************/
 /*******************************************************************/
 
 
 /*******************************************************************/
-// Matrix-vector product: The matrix rows are stored on disk in batches
-// under iodir/<size>/encrypted/batchNNNN/. The query ciphertext contains
-// the query vector, repeatd to fill in all the slots.
-std::vector<Ciphertext<DCRTPoly>> mat_vec_mult(fs::path encdir,
-                Ciphertext<DCRTPoly> qry, const InstanceParams& prms)
+// Multiply the replicas of the queries by the rows and accumulate, this is
+// the part of the matrix-vector product that does not depend on whether
+// the rows are ciphertexts or plaintexts. The rows are taken from the
+// prefetcher in the order (i=0,j=0), (i=0,j=1), ..., where i is the row
+// index within a batch and j is the batch index. The products are added
+// in place to the accumulators (see mult_accumulator.h), so the inner loop
+// does not allocate a new ciphertext for every product.
+template <typename Row>
+static std::vector<std::vector<Ciphertext<DCRTPoly>>> accumulate_products(
+    const std::vector<DFSSlotReplicator*>& replicators,
+    std::vector<Ciphertext<DCRTPoly>>& qrys,
+    Prefetcher<Row>& rows, int n_batches)
 {
-  CryptoContext<DCRTPoly> cc = qry->GetCryptoContext();
-
-  // The input ciphertext includes a pattern of length RECORD_DIM,
-  // repeated N_SLOTS/RECORD_DIM many times to fill all the slot
-  auto n_reps = prms.getNSlots() / prms.getRecordDim();
-  DFSSlotReplicator replicator(cc, prms.getDegrees(), n_reps);
-
-  auto n_batches = prms.getNCtxts();
-  std::vector<Ciphertext<DCRTPoly>> acc(n_batches);  // an accumulator
-  size_t i = 0;  // i is the ciphertext index within a batch
-  for (auto ct_i = replicator.init(qry); ct_i != nullptr;
-       ct_i = replicator.next_replica(), i++) {
-       // ct_i has the i'th entry of the query vector in all its slots
-
-    // read a row from each batch, multiply by ct_i and accumulate
-    std::stringstream ssi;
-    ssi << std::setw(4) << std::setfill('0') << i;
-    for (int j = 0; j < n_batches; j++) {  // j is the batch index
-      std::stringstream ssj;
-      ssj << std::setw(4) << std::setfill('0') << j;
-
-      auto ct_fname = prms.encdir() / 
-          ("batch" + ssj.str()) / ("row_" + ssi.str() + ".bin");
-      Ciphertext<DCRTPoly> ct = get_ctxt(ct_fname);
-      ct = cc->EvalMultNoRelin(ct, ct_i);
-      if (i == 0) {  // initialize the accumulator
-        acc[j] = ct;
-      } else {       // add to the accumulator
-        cc->EvalAddInPlace(acc[j], ct);
+  auto algo = qrys[0]->GetCryptoContext()->GetScheme();
+  int n_queries = qrys.size();
+
+  // acc[q][j] is the accumulator for query q and batch j
+  std::vector<std::vector<MultAccumulator>> acc(
+      n_queries, std::vector<MultAccumulator>(n_batches));
+  std::vector<Ciphertext<DCRTPoly>> ct_i(n_queries);
+
+  // The replicators all have the same tree, so they run in lockstep and
+  // run out of replicas together
+  for (size_t i = 0; ; i++) {  // i is the ciphertext index within a batch
+    parallel_for(n_queries, [&](int q) {
+      // ct_i[q] has the i'th entry of query q in all its slots
+      ct_i[q] = (i == 0) ? replicators[q]->init(qrys[q])
+                         : replicators[q]->next_replica();
+
+      // Rescale ct_i[q] once here, rather than have every multiplication
+      // below rescale its own copy of it
+      if (ct_i[q] != nullptr && ct_i[q]->GetNoiseScaleDeg() > 1) {
+        algo->ModReduceInternalInPlace(ct_i[q], BASE_NUM_LEVELS_TO_DROP);
+      }
+    });
+    if (ct_i[0] == nullptr) {
+      break;
+    }
+
+    // take a row from each batch, multiply by all the ct_i[q]'s and
+    // accumulate. The batches are independent of each other (they only
+    // share the read-only ct_i's), so they are spread across the available
+    // cores. Each row is loaded once and then used for all the queries.
+    parallel_for(n_batches, [&](int j) {  // j is the batch index
+      auto row = rows.get(i * n_batches + j);
+      for (int q = 0; q < n_queries; q++) {
+        acc[q][j].add_product(ct_i[q], row);
       }
+    });
+  }
+  std::cout << "         [server] " << rows.report() << std::endl;
+  std::cout << "         [server] multiply-accumulate kernel: "
+            << MultAccumulator::kernel_name() << std::endl;
+
+  std::vector<std::vector<Ciphertext<DCRTPoly>>> sums(
+      n_queries, std::vector<Ciphertext<DCRTPoly>>(n_batches));
+  for (int q = 0; q < n_queries; q++) {
+    for (int j = 0; j < n_batches; j++) {
+      sums[q][j] = acc[q][j].get();
     }
   }
+  return sums;
+}
+
+// With complex slots, the sums of products hold half the inner products
+// in their real parts (see the NOTE in params.h). Adding the complex
+// conjugate, which is the automorphism X -> X^{2N-1}, doubles the real
+// parts and cancels the imaginary ones.
+static void add_conjugates(
+    std::vector<std::vector<Ciphertext<DCRTPoly>>>& acc,
+    const InstanceParams& prms) {
+  int n_batches = acc.front().size();
+  uint32_t conj = 2 * prms.getRingDim() - 1;
+  parallel_for(acc.size() * n_batches, [&](int k) {
+    auto& ct = acc[k / n_batches][k % n_batches];
+    auto cc = ct->GetCryptoContext();
+    auto ct_conj = cc->EvalAutomorphism(
+        ct, conj, cc->GetEvalAutomorphismKeyMap(ct->GetKeyTag()));
+    cc->EvalAddInPlace(ct, ct_conj);
+  });
+}
+
+// Matrix-vector products: The matrix rows are stored on disk in batches
+// under iodir/<size>/server/batchNNNN/. Each query ciphertext contains
+// its query vector, repeatd to fill in all the slots. The rows were
+// already brought to the level of the replicas by server_preprocess_dataset.
+// Index j of the results is for batch #batches[j].
+std::vector<std::vector<Ciphertext<DCRTPoly>>> mat_vec_mult(
+                const EncryptedDB& db, const std::vector<int>& batches,
+                const std::vector<DFSSlotReplicator*>& replicators,
+                std::vector<Ciphertext<DCRTPoly>>& qrys,
+                const InstanceParams& prms,
+                size_t prefetch_depth, int n_readers)
+{
+  CryptoContext<DCRTPoly> cc = qrys[0]->GetCryptoContext();
+
+  // Reader threads load the rows in the order that they are used, so the
+  // disk reads (page faults on the mapped containers) overlap with the
+  // replication and multiplication.
+  int n_batches = batches.size();
+  size_t n_rows = size_t(prms.getNRows()) * n_batches;
+
+  if (db.plaintext_rows()) {
+    // The server knows the dataset, the plaintext-ciphertext products
+    // have only two components so there is nothing to relinearize
+    PtxtPrefetcher rows(n_rows,
+                        [&db, &batches, n_batches](size_t idx) {
+                          return db.get_row_plaintext(
+                              batches[idx % n_batches], idx / n_batches);
+                        },
+                        prefetch_depth, n_readers);
+    auto acc = accumulate_products(replicators, qrys, rows, n_batches);
+    if (prms.hasComplexSlots()) {
+      add_conjugates(acc, prms);
+    }
+    return acc;
+  }
+
+  CtxtPrefetcher rows(n_rows,
+                      [&db, &batches, n_batches](size_t idx) {
+                        return db.get_row(batches[idx % n_batches],
+                                          idx / n_batches);
+                      },
+                      prefetch_depth, n_readers);
+  auto acc = accumulate_products(replicators, qrys, rows, n_batches);
+
   // relinearize the accumulators
-  for (int j = 0; j < n_batches; j++) {
-    cc->RelinearizeInPlace(acc[j]);
+  int n_queries = acc.size();
+  parallel_for(n_queries * n_batches, [&](int k) {
+    cc->RelinearizeInPlace(acc[k / n_batches][k % n_batches]);
+  });
+  if (prms.hasComplexSlots()) {
+    add_conjugates(acc, prms);
   }
   return acc;
 }
 
 /*******************************************************************/
-// Compare each slot in the results ctxts to the threshold, using a
-// Chebyshev approximation of the indicator function chi(x)=(x>=threshold).
+// Compare each slot in the results ctxts to the thresholds, using Chebyshev
+// approximations of the indicator functions chi(x)=(x>=threshold).
 // If we only want to count the matches, then we use use a higher-degree
 // approximation since (a) we care about good approximation for both matches
 // and non-matches and (b) we can afford it level-wise.
@@ -403,25 +908,64 @@ double sigmoid(double x, double outscale = 1.0,
   return outscale / (1.0 + std::exp(-(x * inscale)));
 }
 
-void compare_to_threshold(std::vector<Ciphertext<DCRTPoly>>& ctxts,
-                          double threshold, bool count_only) {
+// Evaluate all the series on every one of the ctxts, computing the
+// Chebyshev basis of each ciphertext only once. Returns results[s][i] for
+// series s and ctxts[i].
+static std::vector<std::vector<Ciphertext<DCRTPoly>>> evaluate_series(
+    const std::vector<Ciphertext<DCRTPoly>>& ctxts,
+    const std::vector<std::vector<double>>& series, size_t degree) {
+  std::vector<std::vector<Ciphertext<DCRTPoly>>> results(
+      series.size(), std::vector<Ciphertext<DCRTPoly>>(ctxts.size()));
+  parallel_for_stealing(int(ctxts.size()), [&](int i) {
+    ChebyshevBasis basis(ctxts[i], degree, series.size());
+    for (size_t s = 0; s < series.size(); s++) {
+      results[s][i] = basis.evaluate(series[s]);
+    }
+  });
+  return results;
+}
+
+std::vector<std::vector<Ciphertext<DCRTPoly>>> compare_to_thresholds(
+    const std::vector<Ciphertext<DCRTPoly>>& ctxts,
+    const std::vector<double>& thresholds, bool count_only) {
   double outscale = count_only? 1.0 : 0.504;
-  auto func = [threshold, outscale](double x) {
-    return sigmoid(x - threshold, outscale);
-  };
   size_t degree = (count_only? 247 : 59);  // options are 59, 119, 247
-  auto cc = ctxts.front()->GetCryptoContext();
-  for (auto& ct : ctxts) {
-    ct = cc->EvalChebyshevFunction(func, ct, -1.0, 1.0, degree);
+  std::vector<std::vector<double>> series;
+  for (double threshold : thresholds) {
+    series.push_back(ChebyshevBasis::coefficients(
+        [threshold, outscale](double x) {
+          return sigmoid(x - threshold, outscale);
+        }, degree));
   }
   // NOTE: If these results are not accurate enough then we can either switch
   // to higher-degree approximation or just suqare the result to get a better
   // approximation of the non-matches.
+  return evaluate_series(ctxts, series, degree);
+}
+
+// The band functions are differences of the sigmoids of compare_to_thresholds,
+// so they all have the same degree and are evaluated on one basis
+std::vector<std::vector<Ciphertext<DCRTPoly>>> compare_to_ladder(
+    const std::vector<Ciphertext<DCRTPoly>>& ctxts,
+    const std::vector<double>& ladder) {
+  constexpr double outscale = 0.504;
+  constexpr size_t degree = 59;
+  std::vector<std::vector<double>> series;
+  for (size_t b = 0; b < ladder.size(); b++) {
+    if (b > 0 && ladder[b] >= ladder[b - 1]) {
+      throw std::invalid_argument("the ladder thresholds must decrease");
+    }
+    series.push_back(ChebyshevBasis::coefficients([&ladder, b](double x) {
+      double above = (b == 0) ? 0.0 : sigmoid(x - ladder[b - 1], outscale);
+      return sigmoid(x - ladder[b], outscale) - above;
+    }, degree));
+  }
+  return evaluate_series(ctxts, series, degree);
 }
 
 /*******************************************************************/
-// Compare each point in the vectors to the number, using a Chebyshev
-// approximation of the function chi(x) = (x == number).
+// Compare each point in the vectors to each of the numbers, using Chebyshev
+// approximations of the functions chi_i(x) = (x == numbers[i]).
 
 // An impulse-like function, with impule(0)==1.
 // The constant 0.04 was determined by experiments.
@@ -431,18 +975,28 @@ double impulse(double x, double sigma = impulse_sigma) {
   return std::exp(-x_over_sigma*x_over_sigma / 2);
 }
 
-std::vector<Ciphertext<DCRTPoly>> compare_to_number(
-    const std::vector<Ciphertext<DCRTPoly>>& ctxts, double number) {
-  auto func = [number](double x) {
-    return impulse(x - number);
-  };
-  constexpr size_t degree = 119;  // options are 59, 119, 247
+constexpr size_t impulse_degree = 119;  // options are 59, 119, 247
+
+std::vector<std::vector<double>> impulse_series(
+    const std::vector<double>& numbers) {
+  std::vector<std::vector<double>> series;
+  for (double number : numbers) {
+    series.push_back(ChebyshevBasis::coefficients(
+        [number](double x) { return impulse(x - number); }, impulse_degree));
+  }
+  return series;
+}
 
-  auto cc = ctxts[0]->GetCryptoContext();
+// The same Chebyshev basis is used for all the numbers, only the
+// coefficients differ
+std::vector<Ciphertext<DCRTPoly>> compare_to_numbers(
+    const Ciphertext<DCRTPoly>& ct,
+    const std::vector<std::vector<double>>& series) {
+  ChebyshevBasis basis(ct, impulse_degree, series.size());
   std::vector<Ciphertext<DCRTPoly>> results;
-  results.reserve(ctxts.size());
-  for (auto& ct : ctxts) {
-    results.push_back(cc->EvalChebyshevFunction(func, ct, -1.0, 1.0, degree));
+  results.reserve(series.size());
+  for (const auto& coeffs : series) {
+    results.push_back(basis.evaluate(coeffs));
   }
   return results;
 }
@@ -471,20 +1025,3 @@ Ciphertext<DCRTPoly> total_sums(
   }
   return results;
 }
-
-// Read the ith payload value in a batch of records from disk
-Ciphertext<DCRTPoly> get_encrypted_payload(fs::path datadir, size_t batch,
-                                            size_t idx) {
-  std::stringstream ssi, ssj;
-  ssj << std::setw(4) << std::setfill('0') << batch;
-  ssi << std::setw(4) << std::setfill('0') << idx;
-  auto dir = datadir / ("batch" + ssj.str());
-  auto ct_fname = dir / ("payload_" + ssi.str() + ".bin");
-
-  // read the i'th payload ciphertext from this batch
-  Ciphertext<DCRTPoly> result;
-  if (!Serial::DeserializeFromFile(ct_fname, result, SerType::BINARY)) {
-    throw std::runtime_error("failed to read ciphertext from " + ct_fname.string());
-  }
-  return result;
-}
@@ -6,4 +6,154 @@
 // This software is licensed under the terms of the Apache License v2.
 // See the file LICENSE.md for details.
 //============================================================================
-int main(){ return 0; }
+// The client encrypts the dataset rows at some fixed level, but in the
+// matrix-vector product they are multiplied by replicas of the query that
+// are at a higher level. Left as is, every one of these multiplications
+// would first bring its row down to the level of the replica, and this
+// would be repeated for every query. Instead we do it here once, and write
+// the result to the server's own copy of the dataset under iodir/server/.
+// (The ciphertexts are always kept in evaluation form, so there is no NTT
+// to apply ahead of time, the multiplication itself is pointwise.)
+//
+// If the rows were stored as plaintexts (--plaintext_db), then there is
+// nothing to adjust: the client must have encoded them at the level and
+// scale of the replicas, and we only check that it did.
+#include <cassert>
+
+#include "openfhe.h"
+// header files needed for de/serialization
+#include "ciphertext-ser.h"
+#include "cryptocontext-ser.h"
+#include "key/key-ser.h"
+#include "scheme/ckksrns/ckksrns-ser.h"
+
+#include "params.h"
+#include "utils.h"
+#include "parallel.h"
+#include "encrypted_db.h"
+#include "slot_replication.h"
+
+using namespace lbcrypto;
+
+// Read the crypto context, public key, and rotation keys from disk
+PublicKey<DCRTPoly> read_keys(const InstanceParams& prms);
+
+// An all-zero ciphertext at the level and scale of the query replicas
+Ciphertext<DCRTPoly> get_mult_reference(const PublicKey<DCRTPoly>& pk,
+                                        const InstanceParams& prms);
+
+int main(int argc, char* argv[]) {
+  if (argc < 2 || !std::isdigit(argv[1][0])) {
+    std::cout << "Usage: " << argv[0]
+              << " instance-size [--reduce_dim D] [--complex_slots]\n";
+    std::cout << "  Instance-size: 0-TOY, 1-SMALL, 2-MEDIUM, 3-LARGE\n";
+    std::cout << "  --reduce_dim: the records were projected to dimension D"
+              << " (default: no projection, see projection.h)\n";
+    std::cout << "  --complex_slots: the records were encrypted with two"
+              << " entries per slot (see params.h)\n";
+    return 0;
+  }
+  auto size = static_cast<InstanceSize>(std::stoi(argv[1]));
+  InstanceParams prms(size, get_int_option(argc, argv, "--reduce_dim", 0),
+                      has_flag(argc, argv, "--complex_slots"));
+
+  auto pk = read_keys(prms);
+  auto cc = pk->GetCryptoContext();
+  auto zero = get_mult_reference(pk, prms);
+
+  // Every batch must have been fully encrypted (see encrypted_db.h)
+  for (int b = 0; b < prms.getNCtxts(); b++) {
+    if (!fs::exists(batch_dir(prms.encdir(), b) / BATCH_DONE_MARKER)) {
+      throw std::runtime_error("batch " + std::to_string(b) +
+                               " of the dataset was not fully encrypted");
+    }
+  }
+
+  // Copy the dataset to the server directory, bringing the rows to the
+  // level at which they will be used. Adding the (exact) zero ciphertext
+  // makes OpenFHE do the same level-and-scale adjustment that EvalMult
+  // would do, without adding any noise. The batches are independent, so
+  // they are processed in parallel.
+  EncryptedDB db(cc, prms.encdir(), prms.getNCtxts());
+  std::filesystem::create_directories(prms.srvdir());
+  // Records that the client stored with a seed (--seeded) are expanded by
+  // get_row/get_payload, and are written here as full ciphertexts, so the
+  // per-query pass over the dataset does not spend time on the PRG
+  parallel_for(db.n_batches(), [&](int b) {
+    auto dir = batch_dir(prms.srvdir(), b);
+    std::filesystem::create_directory(dir);
+
+    CtxtContainerWriter rows(dir / ROWS_CONTAINER);
+    for (int i = 0; i < prms.getNRows(); i++) {
+      if (db.plaintext_rows()) {
+        auto pt = db.get_row_plaintext(b, i);
+        if (pt->GetLevel() != zero->GetLevel()) {
+          throw std::runtime_error(
+              "plaintext row " + std::to_string(i) + " of batch " +
+              std::to_string(b) + " is at level " +
+              std::to_string(pt->GetLevel()) + ", expected level " +
+              std::to_string(zero->GetLevel()));
+        }
+        rows.append(pt);
+        continue;
+      }
+      auto ct = db.get_row(b, i);
+      if (ct->GetLevel() < zero->GetLevel()) {
+        ct = cc->EvalAdd(ct, zero);
+      }
+      rows.append(ct);
+    }
+    rows.close();
+
+    CtxtContainerWriter payloads(dir / PAYLOADS_CONTAINER);
+    for (int j = 0; j < PAYLOAD_DIM; j++) {
+      payloads.append(db.get_payload(b, j));
+    }
+    payloads.close();
+  });
+  return 0;
+}
+
+// Read the crypto context, public key, and rotation keys from disk
+PublicKey<DCRTPoly> read_keys(const InstanceParams& prms)
+{
+  CryptoContext<DCRTPoly> cc;
+  if (!Serial::DeserializeFromFile(prms.keydir()/"cc.bin",cc,SerType::BINARY)){
+    throw std::runtime_error(
+        "Failed to get CryptoContext from " + prms.keydir().string());
+  }
+  PublicKey<DCRTPoly> pk;
+  if (!Serial::DeserializeFromFile(prms.keydir()/"pk.bin",pk,SerType::BINARY)){
+    throw std::runtime_error(
+        "Failed to get public key from " + prms.keydir().string());
+  }
+  std::ifstream erot_file(prms.keydir()/"rk.bin", std::ios::in | std::ios::binary);
+  if (!erot_file.is_open() ||
+      !cc->DeserializeEvalAutomorphismKey(erot_file, SerType::BINARY)) {
+    throw std::runtime_error(
+      "Failed to get rotation keys from " + prms.keydir().string());
+  }
+  return pk;
+}
+
+// An all-zero ciphertext at the level and scale of the query replicas.
+// Rather than reproduce the level arithmetic of the replication tree, we
+// replicate (the first slot of) an encrypted all-zero query, exactly as
+// the server does for a real query, and subtract the result from itself.
+Ciphertext<DCRTPoly> get_mult_reference(const PublicKey<DCRTPoly>& pk,
+                                        const InstanceParams& prms)
+{
+  auto cc = pk->GetCryptoContext();
+  std::vector<double> zeros(prms.getNSlots(), 0.0);
+  auto qry = cc->Encrypt(pk, cc->MakeCKKSPackedPlaintext(zeros));
+
+  auto n_reps = prms.getNSlots() / prms.getNRows();
+  DFSSlotReplicator replicator(cc, prms.getDegrees(), n_reps);
+  auto ct = replicator.init(qry);
+
+  // The replica is rescaled before it is multiplied (see mat_vec_mult)
+  if (ct->GetNoiseScaleDeg() > 1) {
+    cc->GetScheme()->ModReduceInternalInPlace(ct, BASE_NUM_LEVELS_TO_DROP);
+  }
+  return cc->EvalSub(ct, ct);
+}